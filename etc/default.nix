@@ -1,4 +1,4 @@
-{ stdenv, cmake, python36, python36Packages, curl, ncurses }:
+{ stdenv, cmake, python36, python36Packages, curl, ncurses, zlib }:
 with python36Packages;
 
 let
@@ -103,6 +103,7 @@ in
       curl
       ncurses
       python36
+      zlib
 
       (python36.buildEnv.override {
         extraLibs = [
@@ -1,6 +1,6 @@
 with import <nixpkgs> {};
 mkShell {
   # this adds all the build inputs of your project package
-  inputsFrom = [ (import ./default.nix { inherit stdenv cmake python36 python36Packages curl ncurses; }) ];
+  inputsFrom = [ (import ./default.nix { inherit stdenv cmake python36 python36Packages curl ncurses zlib; }) ];
   buildInputs = with pkgs; [ clang-tools cppcheck python36Packages.pygments ccache ];
 }
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <sstream>
+
+#include <fmt/format.h>
+
+#include "../string.hpp"
+#include "batch.hpp"
+
+namespace bookwyrm::batch {
+
+    /* The fields a search may specify. */
+    static const vector<string> known_fields = {
+        "author", "title", "series", "publisher", "journal", "year", "volume", "number", "extension"};
+
+    /* Split a CSV line into its fields. Quoted fields may contain commas and doubled quotes. */
+    static vector<string> split_csv(const string &line)
+    {
+        vector<string> fields(1);
+        bool quoted = false;
+
+        for (size_t i = 0; i < line.size(); i++) {
+            const char c = line[i];
+
+            if (quoted && c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                fields.back() += '"';
+                i++;
+            } else if (c == '"') {
+                quoted = !quoted;
+            } else if (c == ',' && !quoted) {
+                fields.emplace_back();
+            } else if (c != '\r' || quoted) {
+                fields.back() += c;
+            }
+        }
+
+        if (quoted)
+            throw value_error("unterminated quoted field");
+
+        return fields;
+    }
+
+    static void check_fields(json::object &fields)
+    {
+        /* Allow the plural, as in the JSON output. */
+        if (auto authors = fields.find("authors"); authors != fields.end()) {
+            auto &author = fields["author"];
+            author.insert(author.end(), authors->second.cbegin(), authors->second.cend());
+            fields.erase(authors);
+        }
+
+        for (const auto & [ key, values ] : fields) {
+            std::ignore = values;
+            if (std::find(known_fields.cbegin(), known_fields.cend(), key) == known_fields.cend())
+                throw value_error(fmt::format("unknown field '{}'; known fields are: {}", key, vector_to_string(known_fields)));
+        }
+
+        if (fields.empty())
+            throw value_error("no fields specified");
+    }
+
+    vector<query> read_queries(std::istream &in)
+    {
+        vector<query> queries;
+        std::optional<vector<string>> csv_header;
+        bool first = true;
+
+        string line;
+        for (size_t lineno = 1; std::getline(in, line); lineno++) {
+            const auto trimmed = trim(line);
+            if (trimmed.empty())
+                continue;
+
+            try {
+                if (first) {
+                    first = false;
+                    if (trimmed[0] != '{') {
+                        csv_header = split_csv(trimmed);
+                        continue;
+                    }
+                }
+
+                if (!csv_header) {
+                    auto fields = json::parse_object(line);
+                    check_fields(fields);
+                    queries.push_back({lineno, std::move(fields)});
+                    continue;
+                }
+
+                const auto values = split_csv(line);
+                if (values.size() != csv_header->size())
+                    throw value_error(
+                        fmt::format("expected {} comma-separated fields, got {}", csv_header->size(), values.size()));
+
+                json::object fields;
+                for (size_t i = 0; i < values.size(); i++) {
+                    const auto value = trim(values[i]);
+                    if (value.empty())
+                        continue;
+
+                    const auto key = trim((*csv_header)[i]);
+                    if (key == "author" || key == "authors") {
+                        std::istringstream authors(value);
+                        for (string author; std::getline(authors, author, ';');)
+                            fields[key].push_back(trim(author));
+                    } else {
+                        fields[key] = {value};
+                    }
+                }
+
+                check_fields(fields);
+                queries.push_back({lineno, std::move(fields)});
+            } catch (const value_error &err) {
+                throw value_error(fmt::format("line {}: {}", lineno, err.what()));
+            }
+        }
+
+        return queries;
+    }
+
+} // namespace bookwyrm::batch
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <istream>
+
+#include "../common.hpp"
+#include "json.hpp"
+
+namespace bookwyrm::batch {
+
+    /* One search of a batch, with its fields named like the long command line options (e.g. "author"). */
+    struct query {
+        /* Where the search was read from, for error messages. */
+        size_t line;
+        json::object fields;
+    };
+
+    /*
+     * Read searches, one per line, as JSON Lines or, if the first line isn't a JSON object, as CSV
+     * with a header row naming the fields. In CSV, multiple authors are separated by semicolons.
+     * Blank lines are skipped. Throws value_error naming the first malformed line.
+     */
+    vector<query> read_queries(std::istream &in);
+
+} // namespace bookwyrm::batch
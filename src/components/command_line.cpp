@@ -180,9 +180,87 @@ void cliparser::validate_arguments() const
     if (has("ident") && passed_opts_.size() > 1)
         throw argument_error("ident flag is exclusive and may not be passed with another flag");
 
-    if (!has("ident") && !main_opt_passed)
+    if (!has("ident") && !has("batch") && !has("resume") && !main_opt_passed)
         throw argument_error("at least one main argument must be specified");
 
+    if (has("batch")) {
+        const bool search_opt_passed = std::any_of(valid_groups_[exact].options.cbegin(),
+                                                   valid_groups_[exact].options.cend(),
+                                                   [this](const auto &opt) { return has(opt.flag_long.substr(2)); });
+        if (main_opt_passed || search_opt_passed)
+            throw argument_error("batch searches are read from the batch file; drop any main or exact arguments");
+        if (has(0))
+            throw argument_error("nothing is downloaded in batch mode; drop the download path");
+    }
+
+    if (has("resume")) {
+        const bool search_opt_passed = std::any_of(valid_groups_[exact].options.cbegin(),
+                                                   valid_groups_[exact].options.cend(),
+                                                   [this](const auto &opt) { return has(opt.flag_long.substr(2)); });
+        if (main_opt_passed || search_opt_passed)
+            throw argument_error("--resume downloads what an earlier run left queued; drop any main or exact arguments");
+        if (has("json") || has("batch") || has("auto-select"))
+            throw argument_error("--resume searches nothing; drop --json, --batch and --auto-select");
+    }
+
+    if (has("json") && has("batch"))
+        throw argument_error("batch results are already printed as JSON; drop --json");
+
+    if (has("json") && has(0))
+        throw argument_error("nothing is downloaded with --json; drop the download path");
+
+    if (has("auto-select") && (has("json") || has("batch")))
+        throw argument_error("--auto-select downloads what it picks; drop --json and --batch");
+
+    for (const auto opt : {"prefer", "max-size", "min-year", "confidence"}) {
+        if (has(opt) && !has("auto-select"))
+            throw argument_error(string("--") + opt + " only applies to --auto-select");
+    }
+
+    /* Short enough to always fit in an int. */
+    const auto is_number = [](const string &str) {
+        return !str.empty() && str.size() < 10 && std::all_of(str.cbegin(), str.cend(), ::isdigit);
+    };
+
+    for (const string opt : {"max-size", "limit-rate"}) {
+        if (!has(opt))
+            continue;
+        auto size = get(opt);
+        if (!size.empty() && std::string_view("kKmMgG").find(size.back()) != std::string_view::npos)
+            size.pop_back();
+        if (!is_number(size))
+            throw value_error("malformed " + opt + "; must be a number of bytes, optionally suffixed with K, M or G");
+    }
+
+    if (has("min-year") && !is_number(get("min-year")))
+        throw value_error("malformed min-year");
+
+    if (has("confidence") && (!is_number(get("confidence")) || std::stoi(get("confidence")) > 100))
+        throw value_error("confidence is only valid within the range of 0-100% percent");
+
+    if (has("jobs")) {
+        const auto jobs = get("jobs");
+        if (!has("batch"))
+            throw argument_error("--jobs only applies to --batch");
+        if (jobs.empty() || !std::all_of(jobs.cbegin(), jobs.cend(), ::isdigit) || std::stoul(jobs) == 0)
+            throw value_error("malformed jobs; must be a positive integer");
+    }
+
+    for (const string opt : {"parallel", "race", "segments", "per-host", "limit-rate"}) {
+        if (!has(opt))
+            continue;
+        if (has("json") || has("batch"))
+            throw argument_error("nothing is downloaded with --json or --batch; drop --" + opt);
+        if (opt != "limit-rate" && (!is_number(get(opt)) || std::stoi(get(opt)) == 0))
+            throw value_error("malformed " + opt + "; must be a positive integer");
+    }
+
+    if (has("xattrs") && (has("json") || has("batch")))
+        throw argument_error("nothing is downloaded with --json or --batch; drop --xattrs");
+
+    if (has("race") && has("segments") && std::stoi(get("race")) > 1 && std::stoi(get("segments")) > 1)
+        throw argument_error("racing mirrors and segmented downloads can't be combined; drop --race or --segments");
+
     if (has(1))
         throw argument_error("only one positional argument (the download path) is allowed");
 
@@ -194,6 +272,15 @@ void cliparser::validate_arguments() const
             throw value_error("malformed accuracy");
         }
     }
+
+    if (has("offline") && has("no-catalog"))
+        throw argument_error("offline searching requires the local catalog; drop --no-catalog");
+
+    if (has("max-results")) {
+        const auto max = get("max-results");
+        if (max.empty() || !std::all_of(max.cbegin(), max.cend(), ::isdigit))
+            throw value_error("malformed max-results; must be a non-negative integer");
+    }
 }
 
 bool cliparser::parse_pair(const string_view &input, const string_view &input_next)
@@ -0,0 +1,163 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "disk_writer.hpp"
+
+namespace bookwyrm {
+
+    /* Buffers are aligned to pages, so the kernel can copy them a page at a time. */
+    static constexpr size_t page_size = 4096;
+
+    void disk_writer::stream::open(int fd, std::int64_t offset)
+    {
+        fd_ = fd;
+        offset_ = written_ = offset;
+        used_ = 0;
+        error_ = 0;
+    }
+
+    disk_writer::disk_writer(std::function<void()> on_free, size_t buffers, size_t buffer_size)
+        : buffer_count_(buffers), buffer_size_(buffer_size), on_free_(on_free), thread_(&disk_writer::run, this)
+    {
+    }
+
+    disk_writer::~disk_writer()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        queued_.notify_one();
+        thread_.join();
+
+        for (char *buffer : free_)
+            std::free(buffer);
+    }
+
+    bool disk_writer::write(stream &s, const char *data, size_t length)
+    {
+        /* How many more buffers the data needs. */
+        const size_t room = s.buffer_ ? buffer_size_ - s.used_ : 0;
+        const size_t needed = length > room ? (length - room + buffer_size_ - 1) / buffer_size_ : 0;
+
+        vector<char *> fresh;
+        bool refused = false;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (free_.size() + (buffer_count_ - allocated_) < needed) {
+                refused = true;
+            } else {
+                for (; fresh.size() < needed && !free_.empty(); free_.pop_back())
+                    fresh.push_back(free_.back());
+                for (; fresh.size() < needed; allocated_++) {
+                    char *buffer = static_cast<char *>(std::aligned_alloc(page_size, buffer_size_));
+                    if (!buffer)
+                        throw std::bad_alloc();
+                    fresh.push_back(buffer);
+                }
+            }
+        }
+
+        /* Don't hold on to a buffer while waiting for another; all streams could end up waiting. */
+        if (refused) {
+            if (s.buffer_)
+                submit(s);
+            return false;
+        }
+
+        while (length > 0) {
+            if (!s.buffer_) {
+                s.buffer_ = fresh.back();
+                fresh.pop_back();
+            }
+
+            const size_t n = std::min(length, buffer_size_ - s.used_);
+            std::memcpy(s.buffer_ + s.used_, data, n);
+            s.used_ += n;
+            data += n;
+            length -= n;
+
+            if (s.used_ == buffer_size_)
+                submit(s);
+        }
+
+        return true;
+    }
+
+    bool disk_writer::available()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return !free_.empty() || allocated_ < buffer_count_;
+    }
+
+    void disk_writer::submit(stream &s)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            queue_.push_back({&s, s.buffer_, s.offset_, s.used_});
+            s.in_flight_++;
+        }
+        queued_.notify_one();
+
+        s.offset_ += s.used_;
+        s.buffer_ = nullptr;
+        s.used_ = 0;
+    }
+
+    int disk_writer::flush(stream &s)
+    {
+        if (s.buffer_ && s.used_ > 0) {
+            submit(s);
+        } else if (s.buffer_) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            free_.push_back(s.buffer_);
+            s.buffer_ = nullptr;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        written_.wait(lock, [&s]() { return s.in_flight_ == 0; });
+        return s.error_;
+    }
+
+    void disk_writer::run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            queued_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+
+            const auto req = queue_.front();
+            queue_.pop_front();
+            const bool failed = req.s->error_ != 0;
+            lock.unlock();
+
+            /* After an error, the rest of the stream is dropped. */
+            int error = 0;
+            for (size_t done = 0; !failed && done < req.length;) {
+                const ssize_t n = ::pwrite(req.s->fd_, req.buffer + done, req.length - done, req.offset + done);
+                if (n < 0 && errno != EINTR) {
+                    error = errno;
+                    break;
+                }
+                done += std::max<ssize_t>(n, 0);
+            }
+            if (!failed && !error)
+                req.s->written_ = req.offset + req.length;
+
+            lock.lock();
+            if (error)
+                req.s->error_ = error;
+            req.s->in_flight_--;
+            free_.push_back(req.buffer);
+            written_.notify_all();
+
+            lock.unlock();
+            on_free_();
+            lock.lock();
+        }
+    }
+
+} // namespace bookwyrm
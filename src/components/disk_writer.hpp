@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "../common.hpp"
+
+namespace bookwyrm {
+
+    /*
+     * Writes downloaded data to disk on a thread of its own, so that a slow disk doesn't
+     * hold up the transfers. Data is gathered in large, page-aligned buffers, of which there
+     * is a fixed number; once all are in use, write() refuses more until one is written.
+     */
+    class disk_writer {
+    public:
+        /* The writes to one file descriptor, made in order from some offset. */
+        class stream {
+        public:
+            explicit stream() = default;
+            stream(const stream &) = delete;
+
+            /* Start writing to fd at offset. */
+            void open(int fd, std::int64_t offset);
+
+            /* Everything before this offset has been written. */
+            std::int64_t written() const { return written_; }
+
+        private:
+            friend class disk_writer;
+
+            int fd_ = -1;
+            std::int64_t offset_ = 0;
+            char *buffer_ = nullptr;
+            size_t used_ = 0;
+
+            std::atomic<std::int64_t> written_ = 0;
+
+            /* Guarded by the writer's mutex. */
+            size_t in_flight_ = 0;
+            int error_ = 0;
+        };
+
+        /* on_free is called from the writer thread when a buffer is free again. */
+        explicit disk_writer(std::function<void()> on_free, size_t buffers = 16, size_t buffer_size = 1 << 20);
+        ~disk_writer();
+
+        /*
+         * Queue data to be written at the end of the stream. Returns false, having taken
+         * nothing, if there is no free buffer for it; try again once there is.
+         */
+        bool write(stream &s, const char *data, size_t length);
+
+        /* Is a buffer free? */
+        bool available();
+
+        /* Write out the stream's partial buffer and wait until all its data is written. Returns 0 or an errno. */
+        int flush(stream &s);
+
+    private:
+        struct request {
+            stream *s;
+            char *buffer;
+            std::int64_t offset;
+            size_t length;
+        };
+
+        void submit(stream &s);
+        void run();
+
+        const size_t buffer_count_, buffer_size_;
+        std::function<void()> on_free_;
+
+        std::mutex mutex_;
+        std::condition_variable queued_, written_;
+        std::deque<request> queue_;
+        vector<char *> free_;
+        size_t allocated_ = 0;
+        bool stop_ = false;
+
+        std::thread thread_;
+    };
+
+} // namespace bookwyrm
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "core/hash.hpp"
+#include "core/serialize.hpp"
+#include "download_queue.hpp"
+
+namespace bookwyrm {
+
+    /* Bump when the format changes; queues of other versions are ignored. */
+    static const string header = "bookwyrm-queue 1\n";
+
+    /*
+     * After the header, the file is a log of entries, each an operation followed by its payload:
+     *   queued: the serialized item
+     *   done:   the uint64_t hash of the item
+     * An entry torn by a crash can only be the last one, and is ignored.
+     */
+    static constexpr char queued = 'Q', done = 'D';
+
+    static bool write_all(int fd, std::string_view data)
+    {
+        while (!data.empty()) {
+            const ssize_t n = ::write(fd, data.data(), data.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data.remove_prefix(n);
+        }
+
+        return true;
+    }
+
+    download_queue::download_queue(fs::path path) : path_(path)
+    {
+        if (path_.empty())
+            return;
+
+        std::ifstream in(path_, std::ios::binary);
+        const string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (data.compare(0, header.size(), header) != 0) {
+            compact();
+            return;
+        }
+
+        const std::hash<core::item> hash;
+        std::string_view rest(data);
+        rest.remove_prefix(header.size());
+        while (!rest.empty()) {
+            const char op = rest.front();
+            rest.remove_prefix(1);
+
+            if (op == queued) {
+                const size_t length = core::serialize::record_length(rest);
+                if (length < core::serialize::header_size || length > rest.size())
+                    break;
+
+                try {
+                    const auto record = rest.substr(0, length);
+                    const size_t h = hash(core::serialize::decode(record));
+                    if (std::none_of(entries_.cbegin(), entries_.cend(), [h](const auto &e) { return e.first == h; }))
+                        entries_.emplace_back(h, string(record));
+                } catch (const std::runtime_error &) {
+                    break;
+                }
+                rest.remove_prefix(length);
+            } else if (op == done) {
+                if (rest.size() < sizeof(uint64_t))
+                    break;
+
+                uint64_t h;
+                std::memcpy(&h, rest.data(), sizeof(h));
+                entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [h](const auto &e) { return e.first == h; }),
+                               entries_.end());
+                rest.remove_prefix(sizeof(h));
+            } else {
+                break;
+            }
+        }
+
+        compact();
+    }
+
+    download_queue::~download_queue() { close(); }
+
+    vector<core::item> download_queue::items() const
+    {
+        vector<core::item> items;
+        for (const auto &e : entries_)
+            items.push_back(core::serialize::decode(e.second));
+
+        return items;
+    }
+
+    void download_queue::add(const core::item &item)
+    {
+        const size_t h = std::hash<core::item>()(item);
+        if (std::any_of(entries_.cbegin(), entries_.cend(), [h](const auto &e) { return e.first == h; }))
+            return;
+
+        string record;
+        core::serialize::encode(item, record);
+        append(queued, record);
+        entries_.emplace_back(h, std::move(record));
+    }
+
+    void download_queue::remove(const core::item &item)
+    {
+        const uint64_t h = std::hash<core::item>()(item);
+        const auto it = std::find_if(entries_.begin(), entries_.end(), [h](const auto &e) { return e.first == h; });
+        if (it == entries_.end())
+            return;
+
+        entries_.erase(it);
+
+        /* Don't leave an empty queue behind. */
+        if (entries_.empty())
+            compact();
+        else
+            append(done, std::string_view(reinterpret_cast<const char *>(&h), sizeof(h)));
+    }
+
+    void download_queue::compact()
+    {
+        close();
+        if (path_.empty())
+            return;
+
+        std::error_code ec;
+        if (entries_.empty()) {
+            fs::remove(path_, ec);
+            return;
+        }
+
+        string data = header;
+        for (const auto &e : entries_)
+            data += queued + e.second;
+
+        /* Written to a temporary file first, so that a crash leaves either queue whole. */
+        const auto tmp = fs::path(path_).concat(".tmp");
+        const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return;
+        const bool written = write_all(fd, data) && ::fsync(fd) == 0;
+        ::close(fd);
+
+        /* A queue that can't be written is no worse than none. */
+        if (written)
+            fs::rename(tmp, path_, ec);
+        else
+            fs::remove(tmp, ec);
+    }
+
+    void download_queue::append(char op, std::string_view payload)
+    {
+        if (path_.empty())
+            return;
+
+        if (fd_ < 0) {
+            fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd_ < 0)
+                return;
+
+            /* The queue was empty, and so was removed. */
+            if (::lseek(fd_, 0, SEEK_END) == 0 && !write_all(fd_, header)) {
+                close();
+                return;
+            }
+        }
+
+        string entry(1, op);
+        entry += payload;
+        if (!write_all(fd_, entry) || ::fdatasync(fd_) != 0)
+            close();
+    }
+
+    void download_queue::close()
+    {
+        if (fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+    }
+
+} // namespace bookwyrm
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <experimental/filesystem>
+#include <string_view>
+
+#include "../common.hpp"
+#include "core/item.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm {
+
+    /*
+     * The items queued for download and not yet done with, recorded on disk the moment they are
+     * queued and done, so that a run that is interrupted or crashes can be resumed. What was
+     * written of each item is recorded by the journal next to its .part file.
+     * Not thread-safe; the downloader uses it from its own thread only.
+     */
+    class download_queue {
+    public:
+        /* Nothing is recorded if path is empty. Items left queued by an earlier run are loaded. */
+        explicit download_queue(fs::path path);
+        ~download_queue();
+
+        download_queue(const download_queue &) = delete;
+        download_queue &operator=(const download_queue &) = delete;
+
+        /* The items queued, in the order they were queued. */
+        vector<core::item> items() const;
+
+        /* Record the item as queued, unless it already is. */
+        void add(const core::item &item);
+
+        /* Record the item as done with, whether it was downloaded or not. */
+        void remove(const core::item &item);
+
+    private:
+        /* Write the queued items anew, leaving out those done with and any entry torn by a crash. */
+        void compact();
+
+        /* Append an entry to the file and flush it to disk, opening the file first if need be. */
+        void append(char op, std::string_view payload);
+
+        void close();
+
+        const fs::path path_;
+        int fd_ = -1;
+
+        /* The hash of each queued item, and its serialized form. */
+        vector<std::pair<size_t, string>> entries_;
+    };
+
+} // namespace bookwyrm
@@ -1,30 +1,90 @@
+#include <algorithm>
 #include <cerrno>
-#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
 #include <functional>
-#include <iomanip>
-#include <sstream>
-#include <sys/ioctl.h>
+#include <strings.h>
 #include <unistd.h>
+#include <utility>
 
 #include <fmt/ostream.h>
 
 #include "../runes.hpp"
 #include "../string.hpp"
+#include "core/hash.hpp"
 #include "downloader.hpp"
-#include "python.hpp"
 
 namespace bookwyrm {
 
-    downloader::downloader(string download_dir) : pbar(true, true), dldir(download_dir)
+    downloader::downloader(string download_dir,
+                           const core::http_share &share,
+                           resolver &resolver,
+                           scoreboard &scoreboard,
+                           download_queue &queue,
+                           download_options options)
+        : dldir(download_dir), options_(options), share_(share), resolver_(resolver), scoreboard_(scoreboard),
+          queue_(queue),
+          scheduler_{token_bucket(options.max_rate, std::max<curl_off_t>(options.max_rate / 4, 16 * 1024)), {}}
     {
         curl_global_init(CURL_GLOBAL_ALL);
-        curl = curl_easy_init();
-        if (!curl)
+        multi_ = curl_multi_init();
+        if (!multi_)
             throw component_error("curl could not initialize");
-        headers = NULL;
+
+        /* Transfers to a host over its limit are queued by curl until a connection is free. */
+        curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(options_.max_per_host));
+        curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+        writer_ = std::make_unique<disk_writer>([this]() { curl_multi_wakeup(multi_); });
+        post_ = std::make_unique<post_processor>(options_.post_workers, options_.tag_files);
+        thread_ = std::thread(&downloader::run, this);
+
+        /* std::cout << rune::vt100::hide_cursor; */
+    }
+
+    downloader::~downloader()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        changed_.notify_one();
+        curl_multi_wakeup(multi_);
+        thread_.join();
+
+        /* Downloads already complete are still moved into place. */
+        post_.reset();
+
+        /* Its thread may still be waking multi_ after the last flush returned. */
+        writer_.reset();
+
+        for (CURL *curl : handles_) {
+            curl_multi_remove_handle(multi_, curl);
+            curl_easy_cleanup(curl);
+        }
+        curl_multi_cleanup(multi_);
+        curl_global_cleanup();
+
+        /* std::cout << rune::vt100::show_cursor; */
+    }
+
+    CURL *downloader::acquire_handle()
+    {
+        if (!idle_.empty()) {
+            CURL *curl = idle_.back();
+            idle_.pop_back();
+            return curl;
+        }
+
+        CURL *curl = curl_easy_init();
+        if (!curl)
+            return nullptr;
+        handles_.push_back(curl);
+        share_.apply(curl);
 
         curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
         curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (X11; Linux x86_64; rv:57.0) Gecko/20100101 Firefox/57.0");
@@ -32,15 +92,12 @@ namespace bookwyrm {
         /* Complete the connection phase within 30s. */
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30);
 
-        /* Consider HTTP codes >=400 as errors. This option is NOT fail-safe. */
-        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
-
-        /* Set callback function for writing data. */
-        /* curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, downloader::write_data); */
+        /* Write at each transfer's own offset, and look out for Content-Range. */
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, downloader::write_callback);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, downloader::header_callback);
 
         /* Set callback function for progress metering. */
         curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, downloader::progress_callback);
-        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
         curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0);
 
         /*
@@ -52,18 +109,8 @@ namespace bookwyrm {
 
         /* Enable a verbose output. */
         /* curl_easy_setopt(curl, CURLOPT_VERBOSE, 1); */
-        /* curl_easy_setopt(curl,CURLOPT_MAX_RECV_SPEED_LARGE, 1024 * 50); */
-
-        /* std::cout << rune::vt100::hide_cursor; */
-    }
 
-    downloader::~downloader()
-    {
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
-        curl_global_cleanup();
-
-        /* std::cout << rune::vt100::show_cursor; */
+        return curl;
     }
 
     fs::path downloader::generate_filename(const core::item &item)
@@ -74,7 +121,18 @@ namespace bookwyrm {
             base += fmt::format(" ({})", item.exacts.year);
         }
 
-        const auto valid_candidate = [](fs::path p) { return !fs::exists(p); };
+        /* A name is free if it isn't taken, or if it is that of a partial download of this item. */
+        const auto valid_candidate = [&item](fs::path p) {
+            if (fs::exists(p))
+                return false;
+
+            auto part = p += ".part";
+            if (!fs::exists(part))
+                return true;
+
+            const auto journal = journal::load(part += ".journal");
+            return journal && journal->item == std::hash<core::item>()(item);
+        };
 
         /* If filename.ext doesn't exists, we use that. */
         if (auto candidate = base; valid_candidate(candidate.concat("." + item.exacts.extension)))
@@ -103,242 +161,1137 @@ namespace bookwyrm {
         return candidate;
     }
 
-    static void draw_progress_bar(downloader *d, string status_text, const double fraction)
+    /* In seconds; a server asking to wait any longer is given up on for the next mirror. */
+    static constexpr double max_retry_delay = 60;
+
+    /* The md5 a mirror URL names, as libgen's do, lowercased; empty if none. */
+    static string url_md5(const string &url)
     {
-        const int term_width = std::invoke([]() {
-            struct winsize w;
-            ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-            return w.ws_col;
-        });
+        const auto pos = url.find("md5=");
+        if (pos == string::npos || url.size() < pos + 4 + 32)
+            return "";
 
-        int bar_length = 26, min_bar_length = 5, status_text_length = status_text.length() + 6;
+        string md5 = url.substr(pos + 4, 32);
+        if (!std::all_of(md5.cbegin(), md5.cend(), ::isxdigit))
+            return "";
 
-        if (status_text_length + bar_length > term_width)
-            bar_length -= status_text_length + bar_length - term_width;
+        std::transform(md5.begin(), md5.end(), md5.begin(), ::tolower);
+        return md5;
+    }
+
+    std::optional<downloader::source> downloader::resolve(const job &job, size_t mirror)
+    {
+        auto res = resolver_.resolve(job.item, mirror);
+        if (!res || res->url.empty()) {
+            /* Unable to resolve mirror. */
+            scoreboard_.failed(job.item.misc.mirrors[mirror]);
+            return std::nullopt;
+        }
+
+        /* XXX: can Referer be set this way, or must we use CURLOPT_REFERER? */
+        source src{mirror, std::move(res->url), std::move(res->headers), {}};
 
-        /* Don't draw the progress bar if length is less than min_bar_length. */
-        if (bar_length >= min_bar_length)
-            d->pbar.draw(bar_length, fraction);
+        src.digest = url_md5(src.url);
+        if (src.digest.empty())
+            src.digest = url_md5(job.item.misc.mirrors[mirror]);
 
-        std::cerr << status_text << std::flush;
+        return src;
     }
 
-    // TODO: make this use std::optional
-    auto downloader::resolve_mirror(const string &mirror, const core::item &item, vector<py::module> &plugins)
+    bool downloader::launch(transfer &t, const source &src)
     {
-        auto gil = std::make_unique<py::gil_scoped_acquire>();
+        auto &error = t.owner->error;
 
-        for (py::module module : plugins) {
-            std::string name = module.attr("__name__").cast<string>() + ".py";
-            if (item.misc.origin_plugin != name)
-                continue;
+        /* Ranges of a segmented or resumed download write into the same file. */
+        t.fd = ::open(t.path.c_str(), O_WRONLY | O_CREAT | (t.owner->segmented ? 0 : O_TRUNC), 0644);
+        if (t.fd < 0) {
+            error = fmt::format("unable to create this file: {}; reason: {}", t.path.string(), std::strerror(errno));
+            return false;
+        }
 
-            py::object obj = module.attr("resolve")(mirror);
-            if (py::isinstance<py::none>(obj)) {
-                /* Function returned None; unable to resolve. */
-                continue;
-            }
+        /* Reserve room for the whole item without changing the file's size, in case it's a wrong guess. */
+        if (!t.owner->segmented && t.owner->item.exacts.size != core::empty &&
+            fallocate(t.fd, FALLOC_FL_KEEP_SIZE, 0, t.owner->item.exacts.size) != 0 && errno != EOPNOTSUPP) {
+            error = fmt::format("unable to reserve room for {}: {}", t.path.string(), std::strerror(errno));
+            ::close(t.fd);
+            t.fd = -1;
+            return false;
+        }
 
-            return obj.cast<std::pair<string, py::dict>>();
+        t.curl = acquire_handle();
+        if (!t.curl) {
+            error = "curl could not initialize";
+            ::close(t.fd);
+            t.fd = -1;
+            return false;
         }
 
-        return std::pair<string, py::dict>();
+        /* Set HTTP headers, if any are available. */
+        for (const auto &header : src.headers)
+            t.headers = curl_slist_append(t.headers, header.c_str());
+
+        const string range = t.end >= 0 ? fmt::format("{}-{}", t.offset, t.end) : "";
+
+        t.url = src.url;
+        t.digest = src.digest;
+        t.begin = t.offset;
+        t.writer = writer_.get();
+        t.sched = &scheduler_;
+        t.out.open(t.fd, t.offset);
+        curl_easy_setopt(t.curl, CURLOPT_URL, src.url.c_str());
+        curl_easy_setopt(t.curl, CURLOPT_HTTPHEADER, t.headers);
+        curl_easy_setopt(t.curl, CURLOPT_RANGE, range.empty() ? nullptr : range.c_str());
+        curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, &t);
+        curl_easy_setopt(t.curl, CURLOPT_HEADERDATA, &t);
+        curl_easy_setopt(t.curl, CURLOPT_XFERINFODATA, &t);
+        curl_easy_setopt(t.curl, CURLOPT_PRIVATE, &t);
+
+        curl_multi_add_handle(multi_, t.curl);
+        return true;
     }
 
-    bool downloader::sync_download(vector<core::item> items, vector<py::module> &plugins)
+    void downloader::abandon(job &job)
     {
-        bool any_success = false;
+        std::error_code ec;
+        for (auto &t : job.transfers) {
+            release(*t);
+            if (t->path != job.part)
+                fs::remove(t->path, ec);
+        }
+        job.transfers.clear();
+    }
 
-        for (const auto &item : items) {
-            auto filename = generate_filename(item);
-            current_filename_ = filename;
-            bool success = false;
+    fs::path downloader::journal_path(const job &job)
+    {
+        auto path = job.part;
+        return path += ".journal";
+    }
 
-            int mirror_idx = 1;
-            for (const auto &mirror : item.misc.mirrors) {
-                /* Print resolving status. */
-                string status_text = fmt::format(" resolving mirrors... (try {curr}/{total}); {filename}\r",
-                                                 fmt::arg("curr", mirror_idx),
-                                                 fmt::arg("total", item.misc.mirrors.size()),
-                                                 fmt::arg("filename", current_filename_));
-                draw_progress_bar(this, status_text, 0);
+    void downloader::save_journal(job &job)
+    {
+        auto journal = job.journal;
+        for (const auto &t : job.transfers) {
+            if (t->path == job.part)
+                journal.add(t->begin, t->out.written());
+        }
 
-                auto pair = resolve_mirror(mirror, item, plugins);
-                string url = std::get<0>(pair);
-                if (url.empty()) {
-                    /* Unable to resolve mirror. */
-                    continue;
-                }
-                curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-
-                /* Set HTTP headers, if any are available. */
-                curl_slist_free_all(headers);
-                assert(headers == NULL);
-                for (auto &header : std::get<1>(pair)) {
-                    /* XXX: can Referer be set this way, or must we use CURLOPT_REFERER? */
-                    headers = curl_slist_append(headers, fmt::format("{}: {}", header.first, header.second).c_str());
-                }
-                curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        journal.save(journal_path(job));
+        job.journal_saved.reset();
+    }
 
-                std::FILE *out = std::fopen(filename.c_str(), "wb");
-                if (out == NULL) {
-                    /* TODO: test this output */
-                    throw component_error(
-                        fmt::format("unable to create this file: {}; reason: {}", filename.string(), std::strerror(errno)));
-                }
-                curl_easy_setopt(curl, CURLOPT_WRITEDATA, out);
-
-                if (CURLcode res = curl_easy_perform(curl); res != CURLE_OK) {
-                    fmt::print(stderr,
-                               "{}error: item download (mirror {}) failed: {} (CURLcode = {})\n",
-                               rune::vt100::erase_line,
-                               mirror_idx++,
-                               curl_easy_strerror(res),
-                               res);
-
-                    std::fclose(out);
-                    if (fs::file_size(filename) == 0) {
-                        /* TODO: warn the user about file removal (or just warn that the file
-                         * is empty?) */
-                        fs::remove(filename);
-                    }
-
-                } else {
-                    std::cout << '\n';
-
-                    std::fclose(out);
-                    any_success = success = true;
-
-                    /* That source worked, so there is no need to download from the others.
-                     */
-                    break;
+    bool downloader::resume(job &job, const source &src)
+    {
+        const auto &journal = job.journal;
+        if (job.single_stream || journal.ranges.empty() || journal.size <= 0)
+            return false;
+
+        /* Another mirror will do if it names the same md5. */
+        const bool same_url = src.url == journal.url;
+        if (!same_url && (journal.md5.empty() || src.digest != journal.md5))
+            return false;
+
+        /* If the item has changed since, the server sends it whole and we start over. */
+        source from = src;
+        if (same_url && !journal.etag.empty())
+            from.headers.push_back("If-Range: " + journal.etag);
+
+        job.segmented = true;
+        job.size = journal.size;
+        job.segments_done = 0;
+        for (const auto & [ begin, end ] : journal.ranges)
+            job.segments_done += end - begin;
+
+        for (const auto & [ begin, end ] : journal.gaps()) {
+            auto t = std::make_unique<transfer>();
+            t->owner = &job;
+            t->mirror = src.mirror;
+            t->path = job.part;
+            t->offset = begin;
+            t->end = end - 1;
+
+            if (!launch(*t, from)) {
+                abandon(job);
+                return false;
+            }
+            job.transfers.push_back(std::move(t));
+        }
+
+        return true;
+    }
+
+    void downloader::complete(job &job, const fs::path &path)
+    {
+        post_processor::task task;
+        task.path = path;
+        task.filename = job.filename;
+        task.part = job.part;
+        task.journal = journal_path(job);
+        task.md5 = job.journal.md5;
+        task.hash = job.hash;
+        task.hashed = job.hashed;
+        task.url = job.journal.url;
+        task.title = job.item.nonexacts.title;
+        task.authors = vector_to_string(job.item.nonexacts.authors);
+        task.publisher = job.item.nonexacts.publisher;
+        if (job.item.exacts.year != core::empty)
+            task.year = std::to_string(job.item.exacts.year);
+        task.done = [this, &job](post_processor::outcome outcome, const string &message) {
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                processed_.push_back({&job, outcome, message});
+            }
+            changed_.notify_one();
+            curl_multi_wakeup(multi_);
+        };
+
+        job.transfers.clear();
+        job.processing = true;
+        processing_++;
+        post_->submit(std::move(task));
+    }
+
+    void downloader::processed(job &job, post_processor::outcome outcome, const string &message)
+    {
+        job.processing = false;
+        processing_--;
+
+        if (job.dequeued) {
+            std::error_code ec;
+            if (outcome == post_processor::outcome::done)
+                fs::remove(job.filename, ec);
+            return;
+        }
+
+        switch (outcome) {
+        case post_processor::outcome::done:
+            job.done = job.success = true;
+            queue_.remove(job.item);
+            report(false, message);
+            break;
+        case post_processor::outcome::corrupt:
+            /* Start over from the next mirror. */
+            report(true, message);
+            job.journal.ranges.clear();
+            pending_.push_front(&job);
+            break;
+        case post_processor::outcome::failed:
+            report(true, message);
+            job.done = true;
+            queue_.remove(job.item);
+            break;
+        }
+    }
+
+    bool downloader::start(job &job)
+    {
+        job.error.clear();
+        job.split_pending = job.segmented = false;
+        job.segments_done = job.hashed = 0;
+        job.hash = {};
+
+        /* The next mirror that resolves, if any, short of one still being resolved. */
+        const auto next_source = [&]() -> std::optional<source> {
+            for (; job.mirror < job.order.size(); job.mirror++) {
+                if (!resolver_.ready(job.item, job.order[job.mirror]))
+                    return std::nullopt;
+                if (auto src = resolve(job, job.order[job.mirror]); src) {
+                    job.mirror++;
+                    return src;
                 }
             }
+            return std::nullopt;
+        };
+
+        /* If waiting for a mirror to resolve, step() starts the job again once it has. */
+        auto src = next_source();
+        if (!src)
+            return job.mirror < job.order.size();
+
+        if (job.filename.empty()) {
+            job.filename = generate_filename(job.item);
+            job.part = job.filename;
+            job.part += ".part";
+
+            /* generate_filename() picks a name with a journal only if it is of this item. */
+            job.journal.item = std::hash<core::item>()(job.item);
+            if (auto journal = journal::load(journal_path(job)); journal)
+                job.journal = std::move(*journal);
+        }
 
-            if (!success) {
-                fmt::print(stderr,
-                           "error: unable to resolve any mirrors for item: {} - {} ({}).\n"
-                           "Mirrors: {}.\n"
-                           "Please submit a bug report.\n",
-                           vector_to_string(item.nonexacts.authors),
-                           item.nonexacts.title,
-                           item.exacts.year,
-                           vector_to_string(item.misc.mirrors));
+        job.first_source = *src;
+        if (resume(job, *src)) {
+            if (job.transfers.empty())
+                complete(job, job.part);
+            return true;
+        } else if (!job.error.empty()) {
+            return false;
+        }
+
+        /* Start over. */
+        const size_t item = job.journal.item;
+        job.journal = {};
+        job.journal.item = item;
+        job.journal.url = src->url;
+        job.journal.md5 = src->digest;
+        std::error_code ec;
+        fs::remove(journal_path(job), ec);
+
+        const bool racing = options_.race_mirrors > 1;
+        const bool segmenting = !racing && !job.single_stream && options_.segments > 1 &&
+                                job.item.exacts.size != core::empty && job.item.exacts.size >= options_.segment_min;
+
+        /* Racing transfers write elsewhere; claim the name so no other item takes it meanwhile. */
+        if (auto *claim = racing ? std::fopen(job.part.c_str(), "wb") : nullptr; claim)
+            std::fclose(claim);
+
+        for (; src; src = job.transfers.size() < options_.race_mirrors ? next_source() : std::nullopt) {
+            auto t = std::make_unique<transfer>();
+            t->owner = &job;
+            t->mirror = src->mirror;
+            t->path = job.part;
+            if (racing)
+                t->path.replace_extension(fmt::format(".mirror{}.part", src->mirror + 1));
+
+            if (segmenting) {
+                /* Ask for the first range only; the server's answer decides whether to split. */
+                t->end = job.item.exacts.size / static_cast<curl_off_t>(options_.segments) - 1;
+            }
+
+            if (!launch(*t, *src)) {
+                if (racing)
+                    fs::remove(t->path, ec);
+                abandon(job);
+                return false;
             }
+            job.transfers.push_back(std::move(t));
         }
 
-        return any_success;
+        job.race_started.reset();
+        return true;
     }
 
-    int
-    downloader::progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+    bool downloader::split(job &job)
     {
-        /* We never upload anything. */
-        std::ignore = ulnow;
-        std::ignore = ultotal;
+        job.split_pending = false;
+        job.segmented = true;
+
+        const auto &first = *job.transfers.front();
+        job.size = job.journal.size = first.total;
+
+        /* Allocate the whole file up front; the segments are written at their offsets. */
+        if (const int err = posix_fallocate(first.fd, 0, job.size); err != 0) {
+            job.error = fmt::format("unable to allocate {}: {}", first.path.string(), std::strerror(err));
+            return false;
+        }
+
+        const curl_off_t begin = first.end + 1;
+        if (begin >= job.size)
+            return true;
 
         /*
-         * dltotal: the size of the file being downloaded (in bytes)
-         * dlnow:   how much have been downloaded thus far (in bytes)
+         * At most max_per_host connections are made to a host, so resolve
+         * the next few mirrors to fetch all segments at once, if any resolve.
+         */
+        vector<source> sources = {job.first_source};
+        for (size_t m = job.mirror; m < job.order.size() && sources.size() * options_.max_per_host < options_.segments;
+             m++) {
+            /* Only a mirror of the same item will do, and only if resolved already; the first range is running. */
+            if (!resolver_.ready(job.item, job.order[m]))
+                continue;
+            if (auto src = resolve(job, job.order[m]); src && src->digest == job.first_source.digest)
+                sources.push_back(std::move(*src));
+        }
+
+        const auto count = static_cast<curl_off_t>(options_.segments - 1);
+        const curl_off_t length = (job.size - begin + count - 1) / count;
+        for (curl_off_t i = 0; i < count && begin + i * length < job.size; i++) {
+            const auto &src = sources[(i + 1) % sources.size()];
+
+            auto t = std::make_unique<transfer>();
+            t->owner = &job;
+            t->mirror = src.mirror;
+            t->path = first.path;
+            t->offset = begin + i * length;
+            t->end = std::min(t->offset + length, job.size) - 1;
+
+            if (!launch(*t, src))
+                return false;
+            job.transfers.push_back(std::move(t));
+        }
+
+        return true;
+    }
+
+    void downloader::release(transfer &t)
+    {
+        curl_multi_remove_handle(multi_, t.curl);
+        idle_.push_back(t.curl);
+        t.curl = nullptr;
+        curl_slist_free_all(t.headers);
+        t.headers = nullptr;
+        if (t.throttled) {
+            auto &waiting = scheduler_.waiting;
+            waiting.erase(std::find(waiting.begin(), waiting.end(), &t));
+            t.throttled = false;
+        }
+        writer_->flush(t.out);
+        ::close(t.fd);
+        t.fd = -1;
+    }
+
+    void downloader::cancel(transfer &t)
+    {
+        release(t);
+
+        std::error_code ec;
+        fs::remove(t.path, ec);
+    }
+
+    void downloader::judge_race(job &job)
+    {
+        /* Segments aren't racing. */
+        if (job.segmented || job.transfers.size() < 2)
+            return;
+
+        /* Wait for one transfer to have received enough, or, past the deadline, anything at all. */
+        const bool enough = std::any_of(job.transfers.cbegin(), job.transfers.cend(), [this](const auto &t) {
+            return t->dlnow >= options_.race_bytes;
+        });
+        const bool any = std::any_of(job.transfers.cbegin(), job.transfers.cend(), [](const auto &t) { return t->dlnow > 0; });
+        if (!enough && !(any && job.race_started.ms_since_last_update() >= options_.race_ms))
+            return;
+
+        /* Mirrors are resolved one after another, so compare rates rather than bytes. */
+        const auto rate = [](const auto &t) { return t->dlnow / std::max(t->started.ms_since_last_update(), 1.0); };
+        const auto fastest = std::max_element(
+            job.transfers.begin(), job.transfers.end(), [&rate](const auto &a, const auto &b) { return rate(a) < rate(b); });
+
+        std::unique_ptr<transfer> winner = std::move(*fastest);
+        for (auto &t : job.transfers) {
+            if (t)
+                cancel(*t);
+        }
+        job.transfers.clear();
+
+        /* From now on, the kept transfer is journaled like any other. */
+        std::error_code ec;
+        fs::rename(winner->path, job.part, ec);
+        if (ec) {
+            job.error = fmt::format("unable to rename {} to {}: {}", winner->path.string(), job.part.string(), ec.message());
+            cancel(*winner);
+            active_--;
+            fail(job);
+            return;
+        }
+        winner->path = job.part;
+        job.journal.url = winner->url;
+        job.journal.md5 = winner->digest;
+        job.journal.etag = winner->etag;
+        job.transfers.push_back(std::move(winner));
+    }
+
+    void downloader::rewind(job &job, size_t mirror)
+    {
+        job.mirror = std::find(job.order.cbegin(), job.order.cend(), mirror) - job.order.cbegin();
+    }
+
+    std::optional<std::chrono::duration<double>>
+    downloader::retry_delay(job &job, const transfer &t, CURLcode result, long code)
+    {
+        /*
+         * How often to retry a mirror after a kind of failure, and how long to wait before the first retry.
+         * Each kind counts its retries apart, indexed by kind into job.retries.
          */
-        downloader *d = static_cast<downloader *>(clientp);
-
-        double rate;
-        if (curl_easy_getinfo(d->curl, CURLINFO_SPEED_DOWNLOAD, &rate) != CURLE_OK)
-            rate = std::numeric_limits<double>::quiet_NaN();
-
-        if (d->timer.ms_since_last_update() >= 100 || dlnow == dltotal) {
-            d->timer.reset();
-
-            time::duration eta((dltotal - dlnow) / rate);
-            std::stringstream eta_ss;
-            if (eta.hours() > 0) {
-                eta_ss << eta.hours() << "h " << std::setfill('0') << std::setw(2) << eta.minutes() << "m "
-                       << std::setfill('0') << std::setw(2) << eta.seconds() << "s";
-            } else if (eta.minutes() > 0) {
-                eta_ss << eta.minutes() << "m " << std::setfill('0') << std::setw(2) << eta.seconds() << "s";
-            } else {
-                eta_ss << eta.seconds() << "s";
+        struct policy {
+            size_t kind;
+            size_t retries;
+            double delay;
+        };
+
+        const auto classify = [&]() -> std::optional<policy> {
+            switch (result) {
+            case CURLE_COULDNT_RESOLVE_HOST:
+                return policy{0, 1, 2};
+            case CURLE_COULDNT_CONNECT:
+            case CURLE_OPERATION_TIMEDOUT:
+                return policy{1, 2, 1};
+            case CURLE_PARTIAL_FILE:
+            case CURLE_RECV_ERROR:
+            case CURLE_SEND_ERROR:
+            case CURLE_GOT_NOTHING:
+            case CURLE_HTTP2_STREAM:
+                /* What was received is kept; only the rest is asked for again. */
+                return policy{2, 3, 0.5};
+            case CURLE_HTTP_RETURNED_ERROR:
+                if (code == 429)
+                    return policy{3, 3, 5};
+                if (code == 408 || code >= 500)
+                    return policy{4, 2, 2};
+                return std::nullopt;
+            default:
+                return std::nullopt;
+            }
+        };
+
+        const auto pol = classify();
+        if (job.retried_mirror != t.mirror) {
+            job.retried_mirror = t.mirror;
+            job.retries = {};
+        }
+        if (!pol || job.retries[pol->kind] >= pol->retries)
+            return std::nullopt;
+        auto &retries = job.retries[pol->kind];
+
+        /* Exponential, jittered so that retries from many transfers don't all arrive at once. */
+        std::uniform_real_distribution<double> jitter(0.5, 1.5);
+        double delay = std::min(pol->delay * (1 << retries) * jitter(random_), max_retry_delay);
+
+        /* Unless the server says when; if that's too far off, another mirror is better. */
+        if (t.retry_after >= 0) {
+            if (t.retry_after > max_retry_delay)
+                return std::nullopt;
+            delay = t.retry_after + jitter(random_) - 0.5;
+        }
+
+        retries++;
+        return std::chrono::duration<double>(delay);
+    }
+
+    void downloader::finish(transfer &t, CURLcode result)
+    {
+        job &job = *t.owner;
+        const auto drop = [&job](const transfer &t) {
+            job.transfers.erase(std::find_if(
+                job.transfers.begin(), job.transfers.end(), [&t](const auto &other) { return other.get() == &t; }));
+        };
+
+        string disk_error;
+        if (const int err = writer_->flush(t.out); err) {
+            disk_error = fmt::format("unable to write {}: {}", t.path.string(), std::strerror(err));
+            result = CURLE_WRITE_ERROR;
+        }
+
+        /* An error page is refused by the write callback, unless it's empty. */
+        long code = 0;
+        curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &code);
+        if (code >= 400 && disk_error.empty() && (result == CURLE_OK || result == CURLE_WRITE_ERROR))
+            result = CURLE_HTTP_RETURNED_ERROR;
+
+        /* Write errors are ours, or a refused range; neither tells how the host is doing. */
+        if (result == CURLE_OK) {
+            curl_off_t ttfb, rate;
+            curl_easy_getinfo(t.curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+            curl_easy_getinfo(t.curl, CURLINFO_SPEED_DOWNLOAD_T, &rate);
+            scoreboard_.succeeded(job.item.misc.mirrors[t.mirror], ttfb / 1e6, rate);
+        } else if (result != CURLE_WRITE_ERROR) {
+            scoreboard_.failed(job.item.misc.mirrors[t.mirror]);
+        }
+
+        if (!disk_error.empty()) {
+            /* No other mirror will do better; keep what was written, to be resumed once there's room. */
+            std::error_code ec;
+            for (auto &other : job.transfers) {
+                release(*other);
+                if (other->path == job.part)
+                    job.journal.add(other->begin, other->out.written());
+                else
+                    fs::remove(other->path, ec);
+            }
+            job.journal.save(journal_path(job));
+            job.transfers.clear();
+            job.error = disk_error;
+            fail(job);
+            return;
+        }
+
+        if (result == CURLE_OK && job.segmented) {
+            curl_off_t received;
+            curl_easy_getinfo(t.curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+            job.segments_done += received;
+            job.journal.add(t.begin, t.out.written());
+            if (t.begin == 0) {
+                job.hash = t.hash;
+                job.hashed = t.offset;
+            }
+            release(t);
+            drop(t);
+
+            if (!job.transfers.empty())
+                return;
+
+            job.dlnow = job.dltotal = job.size;
+            complete(job, job.part);
+            return;
+        }
+
+        if (result == CURLE_OK) {
+            curl_easy_getinfo(t.curl, CURLINFO_SIZE_DOWNLOAD_T, &job.dlnow);
+            job.dltotal = job.dlnow;
+            job.hash = t.hash;
+            job.hashed = t.offset;
+            release(t);
+
+            for (auto &other : job.transfers) {
+                if (other.get() != &t)
+                    cancel(*other);
+            }
+            complete(job, t.path);
+            return;
+        }
+
+        release(t);
+        report(true,
+               fmt::format("item download (mirror {}) failed: {} (CURLcode = {}{})",
+                           t.mirror + 1,
+                           curl_easy_strerror(result),
+                           result,
+                           result == CURLE_HTTP_RETURNED_ERROR ? fmt::format(", HTTP {}", code) : ""));
+
+        if (t.range_refused) {
+            /* A range was refused; start over, fetching the item whole from the first mirror that served it. */
+            for (auto &other : job.transfers) {
+                if (other.get() != &t)
+                    release(*other);
             }
+            job.transfers.clear();
+            job.single_stream = true;
+            rewind(job, job.first_source.mirror);
+            return;
+        }
+
+        if (t.path != job.part) {
+            /* A racing transfer; the others may still win. */
+            std::error_code ec;
+            fs::remove(t.path, ec);
+            drop(t);
+            return;
+        }
+
+        /* Decided before t goes with the other transfers. */
+        const size_t mirror = t.mirror;
+        const auto delay = retry_delay(job, t, result, code);
+
+        /* Keep what was written, to be resumed from the next mirror or by a later run. */
+        for (auto &other : job.transfers) {
+            if (other.get() != &t)
+                release(*other);
+            job.journal.add(other->begin, other->out.written());
+        }
+        job.journal.save(journal_path(job));
+        job.transfers.clear();
+
+        if (delay) {
+            /* Resume from the same mirror, once it has had time to recover. */
+            report(false, fmt::format("retrying mirror {} in {:.1f}s", mirror + 1, delay->count()));
+            rewind(job, mirror);
+            job.retry_at = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(*delay);
+            return;
+        }
+
+        /* Out of mirrors to resume from; as a last resort, fetch the item whole. */
+        if (job.segmented && !job.single_stream && job.mirror >= job.order.size()) {
+            job.single_stream = true;
+            rewind(job, job.first_source.mirror);
+        }
+    }
+
+    void downloader::report(bool error, const string &message)
+    {
+        std::lock_guard<std::mutex> guard(observer_mutex_);
+        if (on_message_)
+            on_message_(error, message);
+        else if (renderer_)
+            renderer_->print(fmt::format("{}{}", error ? "error: " : "", message));
+        else
+            fmt::print(stderr, "{}{}{}\n", rune::vt100::erase_line, error ? "error: " : "", message);
+    }
+
+    void downloader::observe(std::function<void(bool, const string &)> on_message, std::function<void()> on_progress)
+    {
+        std::lock_guard<std::mutex> guard(observer_mutex_);
+        on_message_ = on_message;
+        on_progress_ = on_progress;
+    }
+
+    void downloader::fail(job &job)
+    {
+        if (!job.error.empty()) {
+            report(true, job.error);
+        } else {
+            report(true,
+                   fmt::format("unable to resolve any mirrors for item: {} - {} ({}).\n"
+                               "Mirrors: {}.\n"
+                               "Please submit a bug report.",
+                               vector_to_string(job.item.nonexacts.authors),
+                               job.item.nonexacts.title,
+                               job.item.exacts.year,
+                               vector_to_string(job.item.misc.mirrors)));
+        }
+
+        job.done = true;
+        job.dlnow = job.dltotal = 0;
+
+        /* It stays queued if there is something to resume. */
+        if (!job.part.empty() && !job.journal.ranges.empty()) {
+            report(false,
+                   fmt::format("The partial download is kept in {}; run bookwyrm --resume to resume it.", job.part.string()));
+            return;
+        }
+
+        queue_.remove(job.item);
+        if (job.part.empty())
+            return;
+
+        /* Don't leave an empty file behind. */
+        std::error_code ec;
+        fs::remove(job.part, ec);
+        fs::remove(journal_path(job), ec);
+    }
+
+    void downloader::discard(job &job)
+    {
+        if (const auto it = std::find(pending_.begin(), pending_.end(), &job); it != pending_.end())
+            pending_.erase(it);
+
+        if (!job.transfers.empty()) {
+            for (auto &t : job.transfers)
+                cancel(*t);
+            job.transfers.clear();
+            active_--;
+        }
+
+        /* Its file is removed once it's in place. */
+        job.done = job.dequeued = true;
+        queue_.remove(job.item);
+        if (job.processing)
+            return;
 
-            /* Download rate unit conversion. */
-            const string rate_unit = std::invoke([&rate]() {
-                constexpr auto k = std::pow(2, 10), M = std::pow(2, 20);
+        std::error_code ec;
+        if (!job.part.empty()) {
+            fs::remove(job.part, ec);
+            fs::remove(journal_path(job), ec);
+        }
+        if (job.success)
+            fs::remove(job.filename, ec);
+    }
+
+    void downloader::stop(job &job)
+    {
+        if (job.transfers.empty())
+            return;
+
+        std::error_code ec;
+        for (auto &t : job.transfers) {
+            release(*t);
+            if (t->path == job.part)
+                job.journal.add(t->begin, t->out.written());
+            else
+                fs::remove(t->path, ec);
+        }
+        job.journal.save(journal_path(job));
+        job.transfers.clear();
+        active_--;
+    }
 
-                if (rate > M) {
-                    rate /= M;
-                    return "MB/s";
-                } else {
-                    rate /= k;
-                    return "kB/s";
+    void downloader::suspend(job &job)
+    {
+        if (const auto it = std::find(pending_.begin(), pending_.end(), &job); it != pending_.end())
+            pending_.erase(it);
+
+        stop(job);
+        job.done = job.suspended = true;
+    }
+
+    void downloader::enqueue(const core::item &item)
+    {
+        /* Resolve the item's mirrors while other items are downloaded. */
+        resolver_.prefetch(item);
+
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            requests_.emplace_back(item, true);
+            busy_ = true;
+        }
+        changed_.notify_one();
+        curl_multi_wakeup(multi_);
+    }
+
+    void downloader::dequeue(const core::item &item)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            requests_.emplace_back(item, false);
+        }
+        changed_.notify_one();
+        curl_multi_wakeup(multi_);
+    }
+
+    void downloader::dequeue_all()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            requests_.clear();
+            dequeue_all_ = true;
+        }
+        changed_.notify_one();
+        curl_multi_wakeup(multi_);
+    }
+
+    bool downloader::wait()
+    {
+        {
+            std::lock_guard<std::mutex> guard(observer_mutex_);
+            renderer_ = std::make_unique<progress_renderer>([this]() { return statuses(); });
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this]() { return !busy_; });
+        }
+        {
+            std::lock_guard<std::mutex> guard(observer_mutex_);
+            renderer_.reset();
+        }
+
+        const auto st = statuses();
+        return std::any_of(st.cbegin(), st.cend(), [](const auto &s) { return s.current == status::state::done; });
+    }
+
+    void downloader::interrupt()
+    {
+        interrupted_ = true;
+        changed_.notify_one();
+        curl_multi_wakeup(multi_);
+    }
+
+    bool downloader::sync_download(vector<core::item> items)
+    {
+        for (const auto &item : items)
+            enqueue(item);
+
+        return wait();
+    }
+
+    vector<downloader::status> downloader::statuses()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return statuses_;
+    }
+
+    void downloader::run()
+    {
+        while (true) {
+            vector<std::pair<core::item, bool>> requests;
+            vector<std::tuple<job *, post_processor::outcome, string>> processed;
+            bool dequeue_all;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [this]() { return stop_ || !requests_.empty() || dequeue_all_ || busy_; });
+                if (stop_)
+                    break;
+                requests = std::move(requests_);
+                requests_.clear();
+                processed = std::move(processed_);
+                processed_.clear();
+                dequeue_all = std::exchange(dequeue_all_, false);
+            }
+
+            for (const auto & [ job, outcome, message ] : processed)
+                this->processed(*job, outcome, message);
+
+            for (auto &job : jobs_) {
+                if (dequeue_all && !job->dequeued)
+                    discard(*job);
+            }
+
+            const std::hash<core::item> hash;
+            for (const auto & [ item, add ] : requests) {
+                const auto queued = std::find_if(jobs_.begin(), jobs_.end(), [&](const auto &job) {
+                    return !job->dequeued && hash(job->item) == hash(item);
+                });
+
+                if (add && queued == jobs_.end()) {
+                    queue_.add(item);
+                    jobs_.push_back(std::make_unique<job>(item));
+                    jobs_.back()->order = scoreboard_.order(item.misc.mirrors, item.exacts.size);
+                    pending_.push_back(jobs_.back().get());
+                } else if (!add && queued != jobs_.end()) {
+                    discard(**queued);
+                }
+            }
+
+            /* Jobs queued meanwhile are left for a later run, too. */
+            if (interrupted_) {
+                for (auto &job : jobs_) {
+                    if (!job->done && !job->processing)
+                        suspend(*job);
                 }
-            });
+            }
+
+            step();
 
-            const double fraction = static_cast<double>(dlnow) / static_cast<double>(dltotal);
-            fmt::print("{}\r  {:.0f}% ", rune::vt100::erase_line, fraction * 100);
+            /* Tell how things are going a few times a second, and as soon as all is done. */
+            const bool idle = pending_.empty() && active_ == 0 && processing_ == 0;
+            if (idle)
+                scoreboard_.save();
+            if (idle || dequeue_all || !requests.empty() || timer.ms_since_last_update() >= 100) {
+                for (auto &job : jobs_)
+                    update_progress(*job);
 
-            string status_text = fmt::format(" {dlnow:.2f}/{dltotal:.2f}MB @ {rate:.2f}{unit} ETA: {eta}; {filename}\r",
-                                             fmt::arg("dlnow", static_cast<double>(dlnow) / std::pow(2, 20)),
-                                             fmt::arg("dltotal", static_cast<double>(dltotal) / std::pow(2, 20)),
-                                             fmt::arg("rate", rate),
-                                             fmt::arg("unit", rate_unit),
-                                             fmt::arg("eta", eta_ss.str()),
-                                             fmt::arg("filename", d->current_filename_));
+                timer.reset();
+                publish();
 
-            /* Draw the progress bar. */
-            draw_progress_bar(d, status_text, fraction);
+                std::lock_guard<std::mutex> guard(observer_mutex_);
+                if (on_progress_)
+                    on_progress_();
+            }
         }
 
-        return 0;
+        /* Keep what was written, to be resumed by a later run. */
+        for (auto &job : jobs_) {
+            if (!job->transfers.empty())
+                suspend(*job);
+        }
+        scoreboard_.save();
+    }
+
+    void downloader::step()
+    {
+        /* Fill up the free transfer slots, with jobs whose next mirror is resolved, so as not to wait for it. */
+        for (auto it = pending_.begin(); active_ < options_.max_transfers && it != pending_.end();) {
+            auto *job = *it;
+            if (job->retry_at > std::chrono::steady_clock::now() ||
+                (job->mirror < job->order.size() && !resolver_.ready(job->item, job->order[job->mirror]))) {
+                ++it;
+                continue;
+            }
+            it = pending_.erase(it);
+
+            if (!start(*job)) {
+                fail(*job);
+            } else if (!job->transfers.empty()) {
+                active_++;
+            } else if (!job->done && !job->processing) {
+                pending_.push_front(job);
+                it = pending_.begin();
+            }
+        }
+
+        int running;
+        curl_multi_perform(multi_, &running);
+
+        /* Before any first range is found done, request the other ranges. */
+        for (auto &job : jobs_) {
+            if (job->split_pending && !split(*job)) {
+                stop(*job);
+                fail(*job);
+            }
+        }
+
+        int queued;
+        while (CURLMsg *msg = curl_multi_info_read(multi_, &queued)) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            transfer *t;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+            auto *job = t->owner;
+            finish(*t, msg->data.result);
+
+            /* Retry with the next mirror, unless other racing transfers are still running. */
+            if (job->transfers.empty()) {
+                active_--;
+                if (!job->done && !job->processing)
+                    pending_.push_front(job);
+            }
+        }
+
+        for (auto &job : jobs_) {
+            judge_race(*job);
+
+            for (auto &t : job->transfers) {
+                if (t->paused && writer_->available()) {
+                    t->paused = false;
+                    curl_easy_pause(t->curl, CURLPAUSE_CONT);
+                }
+            }
+
+            /* Racing transfers aren't journaled; only the one kept is. */
+            if (!job->transfers.empty() && job->transfers.front()->path == job->part &&
+                job->journal_saved.ms_since_last_update() >= 1000)
+                save_journal(*job);
+        }
+
+        /* Hand out the tokens that came in since, in turn; a resumed transfer may take them all. */
+        while (!scheduler_.waiting.empty() && scheduler_.bucket.available()) {
+            auto *t = scheduler_.waiting.front();
+            scheduler_.waiting.pop_front();
+            t->throttled = false;
+            t->turn = true;
+            curl_easy_pause(t->curl, CURLPAUSE_CONT);
+        }
+
+        if (!pending_.empty() || active_ > 0 || processing_ > 0)
+            curl_multi_poll(multi_, nullptr, 0, 100, nullptr);
     }
 
-    string progressbar::build_bar(unsigned int length, double fraction)
+    void downloader::publish()
     {
-        std::ostringstream ss;
+        vector<status> statuses;
+        for (const auto &job : jobs_) {
+            if (job->dequeued)
+                continue;
 
-        /* Validation */
-        if (!std::isnormal(fraction) || fraction < 0.0)
-            fraction = 0.0;
-        else if (fraction > 1.0)
-            fraction = 1.0;
+            status st;
+            st.name = job->filename.empty()
+                          ? fmt::format("{} - {}", vector_to_string(job->item.nonexacts.authors), job->item.nonexacts.title)
+                          : job->filename.filename().string();
+            st.current = job->success ? status::state::done
+                                      : job->suspended ? status::state::queued
+                                                       : job->done ? status::state::failed
+                                                  : job->transfers.empty() && !job->processing ? status::state::queued
+                                                                                               : status::state::active;
+            st.dlnow = job->dlnow;
+            st.dltotal = job->dltotal > 0 ? job->dltotal
+                                          : job->item.exacts.size != core::empty ? job->item.exacts.size : 0;
+            statuses.push_back(std::move(st));
+        }
 
-        const double bar_part = fraction * length;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            statuses_ = std::move(statuses);
+            busy_ = !requests_.empty() || !pending_.empty() || active_ > 0 || processing_ > 0;
+        }
+        done_.notify_all();
+    }
 
-        /* How many whole unicode characters should we print? */
-        const unsigned int whole_bar_chars = std::floor(bar_part);
+    void downloader::update_progress(job &job)
+    {
+        if (job.segmented) {
+            job.dlnow = job.segments_done;
+            for (const auto &t : job.transfers)
+                job.dlnow += t->dlnow;
+            job.dltotal = job.size;
+        } else if (!job.transfers.empty()) {
+            /* Count the transfer furthest along; racing transfers download the same thing. */
+            job.dlnow = job.dltotal = 0;
+            for (const auto &t : job.transfers) {
+                job.dlnow = std::max(job.dlnow, t->dlnow);
+                job.dltotal = std::max(job.dltotal, t->dltotal);
+            }
+        }
+    }
 
-        /* If the bar isn't full, which unicode character should we use? */
-        const unsigned int partial_bar_char_idx = std::floor((bar_part - whole_bar_chars) * 8.0);
+    size_t downloader::write_callback(char *data, size_t size, size_t nmemb, void *userdata)
+    {
+        auto *t = static_cast<transfer *>(userdata);
+        job &job = *t->owner;
+        const size_t length = size * nmemb;
+
+        /* Returning anything but length fails the transfer with CURLE_WRITE_ERROR. */
+        if (!t->checked) {
+            t->checked = true;
+
+            /* An error page; finish() tells it from a write error by the response code. */
+            long code = 0;
+            curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &code);
+            if (code >= 400)
+                return 0;
+
+            if (t->url == job.journal.url)
+                job.journal.etag = t->etag;
+
+            if (t->end >= 0 && code != 206 && !job.segmented) {
+                /* The server ignored the range and sends the whole item. */
+                t->end = -1;
+                job.single_stream = true;
+            } else if (t->end >= 0 && (code != 206 || t->total <= 0 || (job.segmented && t->total != job.size))) {
+                t->range_refused = true;
+                return 0;
+            } else if (t->end >= 0 && !job.segmented) {
+                job.split_pending = true;
+                job.journal.size = t->total;
+            }
 
-        using namespace rune;
+            if (t->end < 0) {
+                curl_off_t total;
+                curl_easy_getinfo(t->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &total);
+                job.journal.size = total;
+            }
+        }
 
-        if (use_colour_)
-            ss << vt100::bar_colour;
+        if (t->end >= 0 && t->offset + static_cast<curl_off_t>(length) > t->end + 1)
+            return 0;
 
-        /* The left border */
-        ss << (use_unicode_ ? bar::unicode::left_border : bar::left_border);
+        /* Over the rate limit, or others are waiting their turn; wait for ours. */
+        auto &sched = *t->sched;
+        if (!sched.bucket.unlimited() && ((!t->turn && !sched.waiting.empty()) || !sched.bucket.available())) {
+            t->throttled = true;
+            sched.waiting.push_back(t);
+            return CURL_WRITEFUNC_PAUSE;
+        }
 
-        /* The filled-in part */
-        unsigned i = 0;
-        for (; i < whole_bar_chars; i++)
-            ss << (use_unicode_ ? bar::unicode::fraction[8] : bar::tick);
+        /* The writer is behind; try again once it has caught up. */
+        if (!t->writer->write(t->out, data, length)) {
+            t->paused = true;
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        sched.bucket.take(length);
+        t->turn = false;
+
+        if (t->begin == 0 && !t->digest.empty())
+            t->hash.update(data, length);
 
-        if (i < length) {
-            /* The last filled in part, if needed. */
-            ss << (use_unicode_ ? bar::unicode::fraction[partial_bar_char_idx] : bar::empty_fill);
+        t->offset += length;
+        return length;
+    }
+
+    size_t downloader::header_callback(char *data, size_t size, size_t nmemb, void *userdata)
+    {
+        auto *t = static_cast<transfer *>(userdata);
+        const size_t length = size * nmemb;
+
+        const string_view header(data, length);
+        const auto is = [&header](std::string_view name) {
+            return header.size() > name.size() && strncasecmp(header.data(), name.data(), name.size()) == 0;
+        };
+
+        /* A new response, as when redirected. */
+        if (is("http/")) {
+            t->retry_after = -1;
+        } else if (is("content-range:")) {
+            /* E.g. "Content-Range: bytes 0-1023/4096"; the total may be "*" if unknown. */
+            const auto total = header.substr(header.rfind('/') + 1);
+            t->total = std::isdigit(total[0]) ? std::strtoll(string(total).c_str(), nullptr, 10) : -1;
+        } else if (is("etag:")) {
+            t->etag = trim(string(header.substr(5)));
+        } else if (is("retry-after:")) {
+            /* Either a number of seconds or an HTTP date. */
+            const auto value = trim(string(header.substr(12)));
+            if (!value.empty() && std::all_of(value.cbegin(), value.cend(), ::isdigit))
+                t->retry_after = std::strtoll(value.c_str(), nullptr, 10);
+            else if (const auto date = curl_getdate(value.c_str(), nullptr); date >= 0)
+                t->retry_after = std::max<curl_off_t>(date - std::time(nullptr), 0);
         }
 
-        /* The not-filled-in part */
-        for (i = whole_bar_chars + 1; i < length; i++)
-            ss << bar::empty_fill;
+        return length;
+    }
 
-        /* The bar's right border */
-        ss << (use_unicode_ ? bar::unicode::right_border : bar::right_border);
+    int
+    downloader::progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+    {
+        /* We never upload anything. */
+        std::ignore = ulnow;
+        std::ignore = ultotal;
 
-        if (use_colour_)
-            ss << vt100::reset_colour;
+        /*
+         * dltotal: the size of the file being downloaded (in bytes)
+         * dlnow:   how much have been downloaded thus far (in bytes)
+         */
+        auto *t = static_cast<transfer *>(clientp);
+        t->dlnow = dlnow;
+        t->dltotal = dltotal;
 
-        return ss.str();
+        return 0;
     }
 
 } // namespace bookwyrm
@@ -1,54 +1,400 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <curl/curl.h>
+#include <deque>
 #include <experimental/filesystem>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <tuple>
 
 #include "../common.hpp"
+#include "core/http_share.hpp"
 #include "core/item.hpp"
+#include "disk_writer.hpp"
+#include "download_queue.hpp"
+#include "journal.hpp"
+#include "md5.hpp"
+#include "post_processor.hpp"
+#include "progress.hpp"
+#include "resolver.hpp"
+#include "scoreboard.hpp"
+#include "token_bucket.hpp"
 #include "time.hpp"
 
 namespace fs = std::experimental::filesystem;
 
 namespace bookwyrm {
 
-    class progressbar {
-    public:
-        progressbar(bool use_unicode, bool use_colour) : use_unicode_(use_unicode), use_colour_(use_colour) {}
+    struct download_options {
+        /* How many transfers to run at once, in total and per host. */
+        size_t max_transfers = 4;
+        size_t max_per_host = 2;
 
-        inline void draw(unsigned int length, double fraction) { std::cerr << build_bar(length, fraction); }
+        /*
+         * How many mirrors of an item to start at once. When more than one, the racing transfers
+         * run until race_ms has passed or one has received race_bytes; the fastest is kept.
+         */
+        size_t race_mirrors = 1;
+        double race_ms = 3000;
+        curl_off_t race_bytes = 512 * 1024;
 
-    private:
-        string build_bar(unsigned int length, double fraction);
+        /*
+         * How many ranges to split an item of at least segment_min bytes into, each fetched on its
+         * own connection. Items are fetched whole from servers that don't serve ranges.
+         */
+        size_t segments = 1;
+        curl_off_t segment_min = 16 * 1024 * 1024;
+
+        /* How many bytes a second to receive, across all transfers; unlimited if zero. */
+        curl_off_t max_rate = 0;
 
-        const bool use_unicode_, use_colour_;
+        /* How many completed downloads to check and move into place at once, and whether to tag them. */
+        size_t post_workers = 2;
+        bool tag_files = false;
     };
 
+    /*
+     * Downloads items on a thread of its own, running up to download_options::max_transfers
+     * at once. Each item's mirrors are tried in turn until one works.
+     */
     class downloader {
     public:
-        explicit downloader(string download_dir);
+        using status = download_status;
+
+        explicit downloader(string download_dir,
+                            const core::http_share &share,
+                            resolver &resolver,
+                            scoreboard &scoreboard,
+                            download_queue &queue,
+                            download_options options = {});
+
+        /* Partial downloads that are still running are kept, to be resumed by a later run. */
         ~downloader();
 
+        /* Start downloading the item in the background, unless it already is. */
+        void enqueue(const core::item &item);
+
+        /* Stop downloading the item, discarding what was written of it. */
+        void dequeue(const core::item &item);
+
+        /* Dequeue all items. */
+        void dequeue_all();
+
         /*
-         * Downloads the given items in a blocking, synchronous order.
+         * Block until all queued items are done, drawing their progress meanwhile.
          * Returns true if at least one item was downloaded.
          */
-        bool sync_download(vector<core::item> items, vector<py::module> &plugins);
+        bool wait();
 
-        auto resolve_mirror(const string &mirror, const core::item &item, vector<py::module> &plugins);
+        /* Queue the given items and wait for them. */
+        bool sync_download(vector<core::item> items);
+
+        /*
+         * Stop all transfers, keeping what was written and leaving the items queued, to be resumed
+         * by a later run; downloads already complete are still moved into place. Any wait() returns
+         * once that is done. Safe to call from any thread.
+         */
+        void interrupt();
+
+        /* Whether interrupt() was called. */
+        bool interrupted() const { return interrupted_; }
+
+        /* Of all queued items, in the order they were queued. */
+        vector<status> statuses();
+
+        /*
+         * Called from the download thread, instead of printing to stderr: on_message with errors and
+         * notices, and on_progress a few times a second while anything is downloading. Pass none to print again.
+         */
+        void observe(std::function<void(bool error, const string &message)> on_message,
+                     std::function<void()> on_progress);
 
         time::timer timer;
-        progressbar pbar;
 
     private:
+        struct job;
+
+        /* A resolved mirror. */
+        struct source {
+            size_t mirror;
+            string url;
+            vector<string> headers;
+
+            /* The md5 of the item, if the URL or the mirror names it; lowercase hex. */
+            string digest;
+        };
+
+        struct transfer;
+
+        /* Shares the rate limit among the transfers, each taking its turn as tokens come in. */
+        struct scheduler {
+            token_bucket bucket;
+
+            /* Transfers paused for want of tokens, in the order they get them. */
+            std::deque<transfer *> waiting;
+        };
+
+        /* A transfer of an item, or of a range of it, from one of its mirrors. */
+        struct transfer {
+            job *owner;
+            size_t mirror;
+
+            /* Where the data is written; only the kept transfer ends up at owner->filename. */
+            fs::path path;
+            string url, digest;
+
+            /* Where writing started, the next position to write to, and the last byte wanted, if only a range is. */
+            curl_off_t begin = 0, offset = 0, end = -1;
+            bool checked = false;
+
+            /* The server answered the range with something else, and the write callback refused it. */
+            bool range_refused = false;
+
+            /* The item's size, according to a Content-Range header, and its ETag, if any. */
+            curl_off_t total = -1;
+            string etag;
+
+            /* In seconds, as the server asked of a failed request; negative if it didn't. */
+            curl_off_t retry_after = -1;
+
+            CURL *curl = nullptr;
+            int fd = -1;
+            struct curl_slist *headers = nullptr;
+
+            /* Received data goes through the writer; the transfer is paused while it's behind. */
+            disk_writer *writer = nullptr;
+            disk_writer::stream out;
+            bool paused = false;
+
+            /* Paused for want of tokens; once resumed, first to take them. */
+            scheduler *sched = nullptr;
+            bool throttled = false, turn = false;
+
+            /* Of the data received thus far, if writing started at the beginning of the item. */
+            md5 hash;
+
+            /* As reported by curl. */
+            curl_off_t dlnow = 0, dltotal = 0;
+            time::timer started;
+        };
+
+        /* An item to download, and its transfers, if any. */
+        struct job {
+            explicit job(const core::item &item) : item(item) {}
+
+            const core::item item;
+
+            /* Data is written to the .part file, and moved to filename once complete. */
+            fs::path filename, part;
+            struct journal journal;
+            time::timer journal_saved;
+
+            /* The indices of the item's mirrors in the order to try them, and the position in it of the next one to try. */
+            vector<size_t> order;
+            size_t mirror = 0;
+
+            /* How often the mirror last retried was, for each kind of failure, and when the job may be started again. */
+            size_t retried_mirror = 0;
+            std::array<size_t, 5> retries{};
+            std::chrono::steady_clock::time_point retry_at;
+
+            /* More than one while mirrors are racing or segments are fetched. */
+            vector<std::unique_ptr<transfer>> transfers;
+            time::timer race_started;
+
+            /*
+             * A segmented download starts with a request for the first range. If the server
+             * serves it, split() requests the others; if not, the item is fetched whole, and
+             * no ranges are requested again, neither for segments nor to resume.
+             */
+            bool split_pending = false, segmented = false, single_stream = false;
+            curl_off_t size = 0, segments_done = 0;
+            source first_source;
+
+            /*
+             * Of the item's first hashed bytes, received in order. The rest, written out of order
+             * by other segments or by an earlier run, is read back to be hashed once complete.
+             */
+            md5 hash;
+            curl_off_t hashed = 0;
+
+            /* Of the transfer furthest along, for the progress bar. */
+            curl_off_t dlnow = 0, dltotal = 0;
+
+            bool done = false, success = false;
+
+            /* Complete, and being checked and moved into place. */
+            bool processing = false;
+
+            /* A dequeued job is done, but neither shown nor counted. */
+            bool dequeued = false;
+
+            /* Stopped by interrupt(), and left queued. */
+            bool suspended = false;
+
+            /* Why the job failed, if not for want of a resolvable mirror. */
+            string error;
+        };
+
+        static size_t write_callback(char *data, size_t size, size_t nmemb, void *userdata);
+        static size_t header_callback(char *data, size_t size, size_t nmemb, void *userdata);
         static int
         progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
 
+        /*
+         * Start transfers for the job from its next resolvable mirrors, up to
+         * download_options::race_mirrors of them. Returns false if none could be started,
+         * with the reason in job.error unless the job is out of mirrors, and true without
+         * starting any if its next mirror is still being resolved.
+         */
+        bool start(job &job);
+
+        /* Try the given mirror again next. */
+        static void rewind(job &job, size_t mirror);
+
+        /*
+         * How long to wait before retrying the mirror of the failed transfer, if the kind of
+         * failure is likely to pass and the mirror hasn't been retried too often already.
+         */
+        std::optional<std::chrono::duration<double>> retry_delay(job &job, const transfer &t, CURLcode result, long code);
+
+        /* Resolve one of the job's mirrors; waits for the resolver unless it is ready. */
+        std::optional<source> resolve(const job &job, size_t mirror);
+
+        /*
+         * Open the transfer's file and add it to the multi handle. Returns false, with the reason
+         * in the job's error, if the file can't be written or no handle is to be had.
+         */
+        bool launch(transfer &t, const source &src);
+
+        /* Release the transfers of a job whose start failed, removing the files of racing ones. */
+        void abandon(job &job);
+
+        /*
+         * Request the remaining ranges of a segmented download, spread over the mirrors resolved thus far.
+         * Returns false, with the reason in job.error, if the file can't be allocated or a range requested.
+         */
+        bool split(job &job);
+
+        /*
+         * Request the ranges the job's journal lacks, if the source serves the same item.
+         * Returns false if the download must start over, or if a range can't be requested;
+         * job.error tells the two apart.
+         */
+        bool resume(job &job, const source &src);
+
+        /*
+         * Have the finished download at path checked and moved into place, freeing its transfer
+         * slot meanwhile. If the md5 the mirror named doesn't match, the next mirror is tried.
+         */
+        void complete(job &job, const fs::path &path);
+
+        /* Done with the job's download, one way or another. */
+        void processed(job &job, post_processor::outcome outcome, const string &message);
+
+        static fs::path journal_path(const job &job);
+
+        /* Record the progress of the job's transfers in its journal. */
+        void save_journal(job &job);
+
+        /* Stop a transfer and discard what it has written. */
+        void cancel(transfer &t);
+
+        /* Keep the fastest of the racing transfers, once the race is decided; fails the job if it can't be kept. */
+        void judge_race(job &job);
+
+        /*
+         * Clean up after a finished transfer. On success, the job is done; otherwise the transfer is
+         * dropped, and the job should be retried with another mirror once it has no transfers left.
+         */
+        void finish(transfer &t, CURLcode result);
+
+        /* Return a transfer's handle to the pool and close its file descriptor. */
+        void release(transfer &t);
+
+        /* A handle for a new transfer; finished handles are reused. Null if curl can't make one. */
+        CURL *acquire_handle();
+
+        /* Print the message to stderr, or pass it to the observer, if any. */
+        void report(bool error, const string &message);
+
+        /* Give up on the job, once it's out of mirrors. */
+        void fail(job &job);
+
+        /* Stop the job's transfers and discard what was written of it. */
+        void discard(job &job);
+
+        /* Stop the job's running transfers, keeping and journaling what was written of it. */
+        void stop(job &job);
+
+        /* Stop the job's transfers, keeping what was written of it, to be resumed by a later run. */
+        void suspend(job &job);
+
+        /* Runs on thread_ until the downloader is destroyed. */
+        void run();
+
+        /* Start, drive and finish transfers, then wait a little for more to happen, if anything is running. */
+        void step();
+
+        /* Bring the job's dlnow and dltotal up to date with its transfers. */
+        static void update_progress(job &job);
+
+        /* Copy the jobs' state to statuses_. */
+        void publish();
+
         /* Generates a relative filename in dldir to save the given item. */
         fs::path generate_filename(const core::item &item);
 
         const fs::path dldir;
-        CURL *curl;
-        struct curl_slist *headers;
-        string current_filename_;
+        const download_options options_;
+        const core::http_share &share_;
+        resolver &resolver_;
+        scoreboard &scoreboard_;
+        download_queue &queue_;
+        CURLM *multi_;
+        vector<CURL *> handles_, idle_;
+
+        /* Wakes multi_ from its own thread; destroyed before multi_ is cleaned up. */
+        std::unique_ptr<disk_writer> writer_;
+        scheduler scheduler_;
+        std::unique_ptr<post_processor> post_;
+
+        /* For the jitter of retry delays. */
+        std::mt19937 random_{std::random_device()()};
+
+        /* Only touched by the download thread. */
+        vector<std::unique_ptr<job>> jobs_;
+
+        /* Jobs that are waiting for a transfer, in order. A job being retried goes first. */
+        std::deque<job *> pending_;
+        size_t active_ = 0, processing_ = 0;
+
+        /* Guards everything below; changed_ is notified when it changes, done_ once all jobs are done. */
+        std::mutex mutex_;
+        std::condition_variable changed_, done_;
+
+        /* Items to enqueue (true) or dequeue (false), in the order asked. */
+        vector<std::pair<core::item, bool>> requests_;
+        vector<std::tuple<job *, post_processor::outcome, string>> processed_;
+        vector<status> statuses_;
+        bool dequeue_all_ = false, busy_ = false, stop_ = false;
+        std::atomic<bool> interrupted_ = false;
+
+        std::mutex observer_mutex_;
+        std::function<void(bool, const string &)> on_message_;
+        std::function<void()> on_progress_;
+
+        /* Draws the progress while someone waits; messages are printed through it meanwhile. */
+        std::unique_ptr<progress_renderer> renderer_;
+
+        std::thread thread_;
     };
 
 } // namespace bookwyrm
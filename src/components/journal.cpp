@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "journal.hpp"
+
+namespace bookwyrm {
+
+    /* Bump when the format changes; journals of other versions are ignored. */
+    static const string header = "bookwyrm-journal 1";
+
+    void journal::add(std::int64_t begin, std::int64_t end)
+    {
+        if (begin >= end)
+            return;
+
+        ranges.emplace_back(begin, end);
+        std::sort(ranges.begin(), ranges.end());
+
+        /* Merge overlapping and adjacent ranges. */
+        vector<range> merged;
+        for (const auto &r : ranges) {
+            if (!merged.empty() && r.first <= merged.back().second)
+                merged.back().second = std::max(merged.back().second, r.second);
+            else
+                merged.push_back(r);
+        }
+        ranges = std::move(merged);
+    }
+
+    vector<journal::range> journal::gaps() const
+    {
+        vector<range> gaps;
+        std::int64_t pos = 0;
+        for (const auto & [ begin, end ] : ranges) {
+            if (begin > pos)
+                gaps.emplace_back(pos, begin);
+            pos = std::max(pos, end);
+        }
+        if (pos < size)
+            gaps.emplace_back(pos, size);
+
+        return gaps;
+    }
+
+    std::optional<journal> journal::load(const fs::path &path)
+    {
+        std::ifstream in(path);
+        string line;
+        if (!std::getline(in, line) || line != header)
+            return std::nullopt;
+
+        journal j;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            string key;
+            fields >> key >> std::ws;
+
+            if (key == "item") {
+                fields >> j.item;
+            } else if (key == "url") {
+                std::getline(fields, j.url);
+            } else if (key == "md5") {
+                std::getline(fields, j.md5);
+            } else if (key == "etag") {
+                std::getline(fields, j.etag);
+            } else if (key == "size") {
+                fields >> j.size;
+            } else if (key == "range") {
+                std::int64_t begin, end;
+                if (fields >> begin >> end)
+                    j.add(begin, end);
+            }
+
+            if (fields.fail())
+                return std::nullopt;
+        }
+
+        return j;
+    }
+
+    bool journal::save(const fs::path &path) const
+    {
+        auto tmp = path;
+        tmp += ".tmp";
+
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << header << '\n' << "item " << item << '\n' << "size " << size << '\n';
+            if (!url.empty())
+                out << "url " << url << '\n';
+            if (!md5.empty())
+                out << "md5 " << md5 << '\n';
+            if (!etag.empty())
+                out << "etag " << etag << '\n';
+            for (const auto & [ begin, end ] : ranges)
+                out << "range " << begin << ' ' << end << '\n';
+
+            if (!out.flush())
+                return false;
+        }
+
+        std::error_code ec;
+        fs::rename(tmp, path, ec);
+        return !ec;
+    }
+
+} // namespace bookwyrm
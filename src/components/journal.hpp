@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <experimental/filesystem>
+#include <optional>
+#include <utility>
+
+#include "../common.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm {
+
+    /*
+     * What is known of a partial download, kept in a small text file next to it
+     * so that a later run can resume it instead of starting over.
+     */
+    struct journal {
+        using range = std::pair<std::int64_t, std::int64_t>;
+
+        /* The std::hash of the item, to tell whose partial download it is. */
+        size_t item = 0;
+
+        /* Where the data came from; the md5 is that of the whole item, if the mirror told. */
+        string url, md5, etag;
+
+        /* The size of the whole item, if known. */
+        std::int64_t size = -1;
+
+        /* The [begin, end) byte ranges that are written, in order and without overlaps. */
+        vector<range> ranges;
+
+        /* Mark [begin, end) as written. */
+        void add(std::int64_t begin, std::int64_t end);
+
+        /* The ranges that are still missing. Requires a known size. */
+        vector<range> gaps() const;
+
+        /* Returns nothing if the file is missing or isn't a journal. */
+        static std::optional<journal> load(const fs::path &path);
+
+        /* Replace the file at path atomically. Returns false on failure. */
+        bool save(const fs::path &path) const;
+    };
+
+} // namespace bookwyrm
@@ -0,0 +1,288 @@
+#include <cctype>
+#include <optional>
+
+#include <fmt/format.h>
+
+#include "json.hpp"
+
+namespace bookwyrm::json {
+
+    class parser {
+    public:
+        explicit parser(string_view text) : text_(text) {}
+
+        object parse()
+        {
+            object obj;
+
+            expect('{');
+            if (!consume('}')) {
+                do {
+                    string key = parse_string();
+                    expect(':');
+
+                    if (peek() == '[') {
+                        vector<string> values;
+                        expect('[');
+                        if (!consume(']')) {
+                            do {
+                                if (auto value = parse_scalar(); value)
+                                    values.push_back(std::move(*value));
+                            } while (consume(','));
+                            expect(']');
+                        }
+                        obj[std::move(key)] = std::move(values);
+                    } else if (auto value = parse_scalar(); value) {
+                        obj[std::move(key)] = {std::move(*value)};
+                    }
+                } while (consume(','));
+                expect('}');
+            }
+
+            skip_whitespace();
+            if (pos_ != text_.size())
+                fail("trailing characters after object");
+
+            return obj;
+        }
+
+    private:
+        [[noreturn]] void fail(const string &what) const
+        {
+            throw value_error(fmt::format("malformed JSON at column {}: {}", pos_ + 1, what));
+        }
+
+        void skip_whitespace()
+        {
+            while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_])))
+                pos_++;
+        }
+
+        char peek()
+        {
+            skip_whitespace();
+            return pos_ < text_.size() ? text_[pos_] : '\0';
+        }
+
+        bool consume(char c)
+        {
+            if (peek() != c)
+                return false;
+
+            pos_++;
+            return true;
+        }
+
+        void expect(char c)
+        {
+            if (!consume(c))
+                fail(fmt::format("expected '{}'", c));
+        }
+
+        /* Returns nothing for null. */
+        std::optional<string> parse_scalar()
+        {
+            const char c = peek();
+            if (c == '"')
+                return parse_string();
+            if (c == '{' || c == '[')
+                fail("nested values are not supported");
+
+            const size_t start = pos_;
+            while (pos_ < text_.size() && (std::isalnum(static_cast<unsigned char>(text_[pos_])) ||
+                                           text_[pos_] == '-' || text_[pos_] == '+' || text_[pos_] == '.'))
+                pos_++;
+
+            const auto literal = text_.substr(start, pos_ - start);
+            if (literal == "null")
+                return std::nullopt;
+            if (literal == "true" || literal == "false" || (!literal.empty() && (literal[0] == '-' || std::isdigit(literal[0]))))
+                return string(literal);
+
+            fail("expected a value");
+        }
+
+        string parse_string()
+        {
+            expect('"');
+
+            string str;
+            while (pos_ < text_.size() && text_[pos_] != '"') {
+                const char c = text_[pos_++];
+                if (c != '\\') {
+                    str += c;
+                    continue;
+                }
+
+                if (pos_ == text_.size())
+                    break;
+
+                switch (const char escaped = text_[pos_++]; escaped) {
+                case 'b':
+                    str += '\b';
+                    break;
+                case 'f':
+                    str += '\f';
+                    break;
+                case 'n':
+                    str += '\n';
+                    break;
+                case 'r':
+                    str += '\r';
+                    break;
+                case 't':
+                    str += '\t';
+                    break;
+                case 'u':
+                    append_utf8(str, parse_codepoint());
+                    break;
+                default:
+                    str += escaped;
+                }
+            }
+
+            if (pos_ == text_.size())
+                fail("unterminated string");
+            pos_++;
+
+            return str;
+        }
+
+        uint32_t parse_hex4()
+        {
+            if (pos_ + 4 > text_.size())
+                fail("truncated \\u escape");
+
+            uint32_t value = 0;
+            for (const char c : text_.substr(pos_, 4)) {
+                if (!std::isxdigit(static_cast<unsigned char>(c)))
+                    fail("malformed \\u escape");
+                value = value * 16 + (std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+            }
+
+            pos_ += 4;
+            return value;
+        }
+
+        uint32_t parse_codepoint()
+        {
+            const uint32_t high = parse_hex4();
+            if (high < 0xd800 || high > 0xdbff)
+                return high;
+
+            /* A surrogate pair. */
+            if (text_.substr(pos_, 2) != "\\u")
+                fail("unpaired surrogate");
+            pos_ += 2;
+
+            const uint32_t low = parse_hex4();
+            if (low < 0xdc00 || low > 0xdfff)
+                fail("unpaired surrogate");
+
+            return 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00);
+        }
+
+        static void append_utf8(string &str, uint32_t cp)
+        {
+            if (cp < 0x80) {
+                str += static_cast<char>(cp);
+            } else if (cp < 0x800) {
+                str += static_cast<char>(0xc0 | cp >> 6);
+                str += static_cast<char>(0x80 | (cp & 0x3f));
+            } else if (cp < 0x10000) {
+                str += static_cast<char>(0xe0 | cp >> 12);
+                str += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                str += static_cast<char>(0x80 | (cp & 0x3f));
+            } else {
+                str += static_cast<char>(0xf0 | cp >> 18);
+                str += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+                str += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                str += static_cast<char>(0x80 | (cp & 0x3f));
+            }
+        }
+
+        const string_view text_;
+        size_t pos_ = 0;
+    };
+
+    object parse_object(string_view text)
+    {
+        return parser(text).parse();
+    }
+
+    string quote(string_view str)
+    {
+        string quoted = "\"";
+        for (const char c : str) {
+            switch (c) {
+            case '"':
+                quoted += "\\\"";
+                break;
+            case '\\':
+                quoted += "\\\\";
+                break;
+            case '\n':
+                quoted += "\\n";
+                break;
+            case '\r':
+                quoted += "\\r";
+                break;
+            case '\t':
+                quoted += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                    quoted += fmt::format("\\u{:04x}", static_cast<int>(c));
+                else
+                    quoted += c;
+            }
+        }
+
+        return quoted + '"';
+    }
+
+    string from_item(const core::item &item)
+    {
+        string obj;
+        const auto add = [&obj](const char *key, const string &value) {
+            obj += fmt::format("{}\"{}\":{}", obj.empty() ? "" : ",", key, value);
+        };
+        const auto add_string = [&add](const char *key, const string &value) {
+            if (!value.empty())
+                add(key, quote(value));
+        };
+        const auto add_number = [&add](const char *key, int value) {
+            if (value != core::empty)
+                add(key, std::to_string(value));
+        };
+        const auto add_strings = [&add](const char *key, const vector<string> &values) {
+            string list;
+            for (const auto &value : values) {
+                if (!value.empty())
+                    list += (list.empty() ? "" : ",") + quote(value);
+            }
+            if (!list.empty())
+                add(key, '[' + list + ']');
+        };
+
+        add_string("title", item.nonexacts.title);
+        add_strings("authors", item.nonexacts.authors);
+        add_string("series", item.nonexacts.series);
+        add_string("publisher", item.nonexacts.publisher);
+        add_string("journal", item.nonexacts.journal);
+        add_string("edition", item.nonexacts.edition);
+        add_number("year", item.exacts.year);
+        add_number("volume", item.exacts.volume);
+        add_number("number", item.exacts.number);
+        add_number("pages", item.exacts.pages);
+        add_number("size", item.exacts.size);
+        add_string("extension", item.exacts.extension);
+        add_strings("isbns", item.misc.isbns);
+        add_strings("uris", item.misc.uris);
+        add_strings("mirrors", item.misc.mirrors);
+        add_string("plugin", item.misc.origin_plugin);
+
+        return '{' + obj + '}';
+    }
+
+} // namespace bookwyrm::json
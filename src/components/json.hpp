@@ -0,0 +1,30 @@
+#pragma once
+
+#include <map>
+
+#include "../common.hpp"
+#include "core/item.hpp"
+
+/*
+ * Just enough JSON for bookwyrm's machine-readable input and output;
+ * not a general-purpose JSON library.
+ */
+namespace bookwyrm::json {
+
+    /* An object whose values are scalars or arrays of scalars, each held as a list of strings. */
+    using object = std::map<string, vector<string>>;
+
+    /*
+     * Parse a single JSON object, e.g. one line of JSON Lines. Numbers and booleans are kept as
+     * their text, null values are skipped, and nested objects are rejected.
+     * Throws value_error if the text is not such an object.
+     */
+    object parse_object(string_view text);
+
+    /* Quote and escape a string for use as a JSON string. */
+    string quote(string_view str);
+
+    /* Describe an item as a JSON object, leaving out unspecified fields. */
+    string from_item(const core::item &item);
+
+} // namespace bookwyrm::json
@@ -0,0 +1,40 @@
+#include <cstdio>
+
+#include <fmt/format.h>
+
+#include "json.hpp"
+#include "json_lines.hpp"
+
+namespace bookwyrm {
+
+    void json_lines::log(const core::log_level level, const std::string message)
+    {
+        if (!log_debug_ && level <= core::log_level::debug)
+            return;
+
+        const auto line = fmt::format("{{\"type\":\"log\",\"level\":\"{}\",\"message\":{}}}\n",
+                                      core::loglvl_to_string(level),
+                                      json::quote(message));
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        std::fputs(line.c_str(), stderr);
+    }
+
+    void json_lines::found(const core::item &item)
+    {
+        const auto line = json::from_item(item) + '\n';
+
+        /* Flush each item, so that a consumer can start on it right away. */
+        std::lock_guard<std::mutex> guard(mutex_);
+        std::fputs(line.c_str(), stdout);
+        std::fflush(stdout);
+        written_++;
+    }
+
+    size_t json_lines::written() const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return written_;
+    }
+
+} // namespace bookwyrm
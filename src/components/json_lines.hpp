@@ -0,0 +1,31 @@
+#pragma once
+
+#include <mutex>
+
+#include "core/plugin_handler.hpp"
+
+namespace bookwyrm {
+
+    /*
+     * A frontend for pipelines: each found item is written to stdout as a line of JSON the moment
+     * it is accepted, and each log entry to stderr as a line of JSON with its level.
+     */
+    class json_lines : public core::frontend {
+    public:
+        explicit json_lines(bool log_debug) : log_debug_(log_debug) {}
+
+        void update() override {}
+        void log(const core::log_level level, const std::string message) override;
+        void found(const core::item &item) override;
+
+        /* How many items have been written thus far. */
+        size_t written() const;
+
+    private:
+        const bool log_debug_;
+
+        mutable std::mutex mutex_;
+        size_t written_ = 0;
+    };
+
+} // namespace bookwyrm
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "../common.hpp"
+
+namespace bookwyrm {
+
+    /* An incremental MD5 (RFC 1321), to check downloads against the digests mirrors name. */
+    class md5 {
+    public:
+        void update(const char *data, size_t length);
+
+        /* The digest of everything passed to update() thus far, as lowercase hex. */
+        string hexdigest() const;
+
+    private:
+        void transform(const unsigned char *block);
+
+        std::array<std::uint32_t, 4> state_ = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+        std::array<unsigned char, 64> buffer_;
+        std::uint64_t length_ = 0;
+    };
+
+} // namespace bookwyrm
@@ -0,0 +1,122 @@
+#include <fcntl.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "post_processor.hpp"
+
+namespace bookwyrm {
+
+    post_processor::post_processor(size_t threads, bool tag_files) : tag_files_(tag_files)
+    {
+        for (size_t i = 0; i < threads; i++)
+            threads_.emplace_back(&post_processor::run, this);
+    }
+
+    post_processor::~post_processor()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        queued_.notify_all();
+        for (auto &thread : threads_)
+            thread.join();
+    }
+
+    void post_processor::submit(task t)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            queue_.push_back(std::move(t));
+        }
+        queued_.notify_one();
+    }
+
+    void post_processor::run()
+    {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+
+            task t = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+
+            string message;
+            if (!verify(t, message)) {
+                t.done(outcome::corrupt, message);
+                continue;
+            }
+            if (!install(t, message)) {
+                t.done(outcome::failed, message);
+                continue;
+            }
+            if (tag_files_)
+                tag(t);
+
+            t.done(outcome::done, fmt::format("downloaded {}", t.filename.string()));
+        }
+    }
+
+    bool post_processor::verify(task &t, string &message)
+    {
+        if (t.md5.empty())
+            return true;
+
+        /* Hash whatever wasn't hashed as it was received. */
+        if (const int fd = ::open(t.path.c_str(), O_RDONLY); fd >= 0) {
+            vector<char> buffer(1024 * 1024);
+            for (ssize_t n; (n = ::pread(fd, buffer.data(), buffer.size(), t.hashed)) > 0; t.hashed += n)
+                t.hash.update(buffer.data(), n);
+            ::close(fd);
+        }
+
+        const string digest = t.hash.hexdigest();
+        if (digest == t.md5)
+            return true;
+
+        /* Nothing of it can be trusted. */
+        std::error_code ec;
+        fs::remove(t.path, ec);
+        fs::remove(t.part, ec);
+        fs::remove(t.journal, ec);
+
+        message = fmt::format("{} is corrupt: expected md5 {}, got {}", t.filename.string(), t.md5, digest);
+        return false;
+    }
+
+    bool post_processor::install(const task &t, string &message)
+    {
+        std::error_code ec;
+        fs::rename(t.path, t.filename, ec);
+        if (ec) {
+            message = fmt::format("unable to move {} into place: {}", t.path.string(), ec.message());
+            return false;
+        }
+
+        if (t.path != t.part)
+            fs::remove(t.part, ec);
+        fs::remove(t.journal, ec);
+        return true;
+    }
+
+    void post_processor::tag(const task &t)
+    {
+        /* As freedesktop.org recommends; a file system without them is left as is. */
+        const auto set = [&t](const char *name, const string &value) {
+            if (!value.empty())
+                ::setxattr(t.filename.c_str(), name, value.data(), value.size(), 0);
+        };
+
+        set("user.xdg.origin.url", t.url);
+        set("user.dublincore.title", t.title);
+        set("user.dublincore.creator", t.authors);
+        set("user.dublincore.publisher", t.publisher);
+        set("user.dublincore.date", t.year);
+    }
+
+} // namespace bookwyrm
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <experimental/filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "../common.hpp"
+#include "md5.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm {
+
+    /*
+     * Finishes completed downloads on a few threads of its own, so that checking and moving
+     * a large file doesn't hold up the transfers still running. Each download goes through
+     * the stages in turn: its md5 is checked, it's moved into place, and it's tagged.
+     */
+    class post_processor {
+    public:
+        enum class outcome {
+            /* The file is in place. */
+            done,
+            /* It didn't match its md5 and was removed; it should be fetched again. */
+            corrupt,
+            /* It couldn't be moved into place. */
+            failed
+        };
+
+        /* A completed download. */
+        struct task {
+            /* Where the data is, where it goes, and what to clean up once it's there. */
+            fs::path path, filename, part, journal;
+
+            /* The md5 the mirror named, if any, and the hash of the first hashed bytes, as received. */
+            string md5;
+            class md5 hash;
+            std::int64_t hashed = 0;
+
+            /* For the tags: where it was fetched from, and what it is; empty if unknown. */
+            string url, title, authors, publisher, year;
+
+            /* Called on a pool thread once done, with a message to show. */
+            std::function<void(outcome, const string &message)> done;
+        };
+
+        /* Tag files with extended attributes only if tag_files is true. */
+        explicit post_processor(size_t threads, bool tag_files);
+
+        /* Finishes the tasks already submitted first. */
+        ~post_processor();
+
+        void submit(task t);
+
+    private:
+        void run();
+
+        /* The stages; each returns false if the download should go no further. */
+        static bool verify(task &t, string &message);
+        static bool install(const task &t, string &message);
+        static void tag(const task &t);
+
+        const bool tag_files_;
+
+        std::mutex mutex_;
+        std::condition_variable queued_;
+        std::deque<task> queue_;
+        bool stop_ = false;
+
+        vector<std::thread> threads_;
+    };
+
+} // namespace bookwyrm
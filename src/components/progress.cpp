@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "../runes.hpp"
+#include "progress.hpp"
+
+namespace bookwyrm {
+
+    /* Set on SIGWINCH, for the terminal's size to be asked for again. */
+    static std::atomic<bool> resized = true;
+    static struct sigaction previous_winch;
+
+    /* At most this many downloads get a line of their own. */
+    static constexpr size_t max_lines = 8;
+
+    static string megabytes(std::int64_t bytes)
+    {
+        return fmt::format("{:.2f}", static_cast<double>(bytes) / (1 << 20));
+    }
+
+    /* At most width bytes of str, not cutting a UTF-8 sequence in two. */
+    static string truncate(const string &str, size_t width)
+    {
+        if (str.size() <= width)
+            return str;
+
+        size_t end = width;
+        while (end > 0 && (static_cast<unsigned char>(str[end]) & 0xc0) == 0x80)
+            end--;
+        return str.substr(0, end);
+    }
+
+    string progressbar::build_bar(unsigned int length, double fraction) const
+    {
+        /* Validation */
+        if (!std::isnormal(fraction) || fraction < 0.0)
+            fraction = 0.0;
+        else if (fraction > 1.0)
+            fraction = 1.0;
+
+        const double bar_part = fraction * length;
+
+        /* How many whole unicode characters should we print? */
+        const unsigned int whole_bar_chars = std::floor(bar_part);
+
+        /* If the bar isn't full, which unicode character should we use? */
+        const unsigned int partial_bar_char_idx = std::floor((bar_part - whole_bar_chars) * 8.0);
+
+        using namespace rune;
+
+        /* A full unicode glyph is three bytes; leave room for the borders and colours. */
+        string bar;
+        bar.reserve(length * 3 + 32);
+
+        if (use_colour_)
+            bar += vt100::bar_colour;
+        bar += use_unicode_ ? bar::unicode::left_border : bar::left_border;
+
+        const auto &tick = use_unicode_ ? bar::unicode::fraction[8] : bar::tick;
+        for (unsigned i = 0; i < whole_bar_chars; i++)
+            bar += tick;
+
+        if (whole_bar_chars < length) {
+            /* The last filled in part, if needed, and the rest. */
+            bar += use_unicode_ ? bar::unicode::fraction[partial_bar_char_idx] : bar::empty_fill;
+            bar.append(length - whole_bar_chars - 1, ' ');
+        }
+
+        bar += use_unicode_ ? bar::unicode::right_border : bar::right_border;
+        if (use_colour_)
+            bar += vt100::reset_colour;
+
+        return bar;
+    }
+
+    progress_renderer::progress_renderer(std::function<vector<download_status>()> source, std::chrono::milliseconds interval)
+        : source_(source), interval_(interval), bar_(true, true)
+    {
+        struct sigaction winch;
+        winch.sa_handler = [](int) { resized = true; };
+        sigemptyset(&winch.sa_mask);
+        winch.sa_flags = SA_RESTART;
+        sigaction(SIGWINCH, &winch, &previous_winch);
+        resized = true;
+
+        thread_ = std::thread(&progress_renderer::run, this);
+    }
+
+    progress_renderer::~progress_renderer()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        stopped_.notify_one();
+        thread_.join();
+
+        sigaction(SIGWINCH, &previous_winch, nullptr);
+    }
+
+    void progress_renderer::print(const string &line)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        messages_.push_back(line);
+    }
+
+    void progress_renderer::run()
+    {
+        while (true) {
+            vector<string> messages;
+            bool stop;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                stopped_.wait_for(lock, interval_, [this]() { return stop_; });
+                messages = std::move(messages_);
+                messages_.clear();
+                stop = stop_;
+            }
+
+            if (resized.exchange(false)) {
+                struct winsize w;
+                if (ioctl(STDERR_FILENO, TIOCGWINSZ, &w) == 0 && w.ws_col > 0) {
+                    width_ = w.ws_col;
+                    height_ = w.ws_row;
+                }
+            }
+
+            /* Messages go above the progress; the last frame is erased for good. */
+            string frame = erase();
+            drawn_lines_ = 0;
+            for (const auto &msg : messages)
+                frame += msg + '\n';
+            if (!stop)
+                frame += render(source_());
+
+            std::fwrite(frame.data(), 1, frame.size(), stderr);
+            std::fflush(stderr);
+
+            if (stop)
+                return;
+        }
+    }
+
+    string progress_renderer::erase() const
+    {
+        if (drawn_lines_ == 0)
+            return "";
+
+        string up = drawn_lines_ > 1 ? fmt::format("\033[{}A", drawn_lines_ - 1) : "";
+        return "\r" + up + "\033[J";
+    }
+
+    string progress_renderer::render(const vector<download_status> &statuses)
+    {
+        size_t done = 0, total = 0;
+        std::int64_t dlnow = 0, dltotal = 0;
+        vector<const download_status *> active;
+        for (const auto &st : statuses) {
+            total++;
+            done += st.current == download_status::state::done || st.current == download_status::state::failed;
+            dlnow += st.dlnow;
+            if (st.current != download_status::state::failed)
+                dltotal += st.dltotal;
+            if (st.current == download_status::state::active)
+                active.push_back(&st);
+        }
+
+        if (total == 0)
+            return "";
+
+        /* A smoothed transfer rate, from the bytes transferred since the last frame. */
+        const double seconds = std::chrono::duration<double>(interval_).count();
+        if (dlnow >= last_dlnow_)
+            rate_ = 0.7 * rate_ + 0.3 * (dlnow - last_dlnow_) / seconds;
+        last_dlnow_ = dlnow;
+
+        const long eta = rate_ > 0 ? std::max<double>(dltotal - dlnow, 0) / rate_ : 0;
+        const string eta_str = eta >= 3600 ? fmt::format("{}h {:02}m {:02}s", eta / 3600, eta / 60 % 60, eta % 60)
+                                           : eta >= 60 ? fmt::format("{}m {:02}s", eta / 60, eta % 60)
+                                                       : fmt::format("{}s", eta);
+        const string rate_str = rate_ > (1 << 20) ? fmt::format("{:.2f}MB/s", rate_ / (1 << 20))
+                                                  : fmt::format("{:.2f}kB/s", rate_ / (1 << 10));
+
+        /*
+         * "  42% [bar] text", with a bar of 26 cells, or less if the terminal is narrow. Lines
+         * must not wrap, or the next frame won't start where this one did.
+         */
+        static constexpr size_t bar_length = 26, min_bar_length = 5, prefix = 7, borders = 2;
+        const auto line = [this](std::int64_t now, std::int64_t of, const string &text) {
+            const double fraction = of > 0 ? static_cast<double>(now) / of : 0;
+            const size_t room = width_ > prefix + borders + 1 ? width_ - prefix - borders - 1 : 0;
+            size_t length = room > text.size() ? std::min(bar_length, room - text.size()) : 0;
+            if (length < min_bar_length)
+                length = room >= 2 * min_bar_length ? min_bar_length : 0;
+
+            string l = fmt::format("  {:3.0f}% ", fraction * 100);
+            if (length > 0)
+                l += bar_.build_bar(length, fraction);
+            return l + truncate(text, room - length);
+        };
+
+        /* Leave a line for the cursor, and one for the total. */
+        const size_t lines = std::min({active.size(), max_lines, height_ > 2 ? height_ - 2 : 0});
+        vector<string> frame;
+        for (size_t i = 0; i < lines; i++) {
+            const auto &st = *active[i];
+            frame.push_back(
+                line(st.dlnow, st.dltotal, fmt::format(" {}/{}MB {}", megabytes(st.dlnow), megabytes(st.dltotal), st.name)));
+        }
+        if (active.size() > lines)
+            frame.push_back(fmt::format("  ... and {} more", active.size() - lines));
+
+        frame.push_back(line(dlnow,
+                             dltotal,
+                             fmt::format(" {}/{}MB @ {} ETA: {}; {}/{} items",
+                                         megabytes(dlnow),
+                                         megabytes(dltotal),
+                                         rate_str,
+                                         eta_str,
+                                         done,
+                                         total)));
+
+        string out;
+        for (const auto &l : frame) {
+            out += (out.empty() ? "" : "\n") + l;
+            drawn_lines_++;
+        }
+        return out;
+    }
+
+} // namespace bookwyrm
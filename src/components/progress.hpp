@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "../common.hpp"
+
+namespace bookwyrm {
+
+    /* What is known of the download of a queued item. */
+    struct download_status {
+        enum class state { queued, active, done, failed };
+
+        /* The file it's saved to, once known; otherwise the item's authors and title. */
+        string name;
+        state current;
+        std::int64_t dlnow, dltotal;
+    };
+
+    class progressbar {
+    public:
+        progressbar(bool use_unicode, bool use_colour) : use_unicode_(use_unicode), use_colour_(use_colour) {}
+
+        /* A bar of length cells, plus its borders, filled to fraction. */
+        string build_bar(unsigned int length, double fraction) const;
+
+    private:
+        const bool use_unicode_, use_colour_;
+    };
+
+    /*
+     * Draws the progress of downloads to stderr on a thread of its own, at a fixed rate: a line per
+     * running download and one for all of them. Each frame is written at once, from a snapshot taken
+     * from the source, so that drawing never holds up the transfers. The terminal width is only asked
+     * for again when the terminal is resized.
+     */
+    class progress_renderer {
+    public:
+        explicit progress_renderer(std::function<vector<download_status>()> source,
+                                   std::chrono::milliseconds interval = std::chrono::milliseconds(100));
+
+        /* Erases what was drawn. */
+        ~progress_renderer();
+
+        /* Print a line above the progress, with the next frame. */
+        void print(const string &line);
+
+    private:
+        void run();
+
+        /* Returns the frame for the statuses, of no more lines than fit the terminal. */
+        string render(const vector<download_status> &statuses);
+
+        /* Moves the cursor back to where the previous frame started, erasing it. */
+        string erase() const;
+
+        const std::function<vector<download_status>()> source_;
+        const std::chrono::milliseconds interval_;
+        const progressbar bar_;
+
+        /* Only touched by the render thread. */
+        size_t width_ = 80, height_ = 24, drawn_lines_ = 0;
+        std::int64_t last_dlnow_ = 0;
+        double rate_ = 0;
+
+        std::mutex mutex_;
+        std::condition_variable stopped_;
+        vector<string> messages_;
+        bool stop_ = false;
+
+        std::thread thread_;
+    };
+
+} // namespace bookwyrm
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <fstream>
+#include <functional>
+
+#include <fmt/format.h>
+
+#include "resolver.hpp"
+
+namespace bookwyrm {
+
+    /* Bump when the format changes; entries of other versions are ignored. */
+    static const string header = "bookwyrm-mirror 1";
+
+    using clock = std::chrono::system_clock;
+
+    resolver::resolver(vector<py::module> plugins, fs::path cache_dir, std::chrono::seconds ttl, size_t threads)
+        : cache_dir_(cache_dir), ttl_(ttl)
+    {
+        {
+            py::gil_scoped_acquire gil;
+            for (auto &module : plugins)
+                plugins_.emplace(module.attr("__name__").cast<string>() + ".py", std::move(module));
+            plugins.clear();
+        }
+
+        for (size_t i = 0; i < threads; i++)
+            threads_.emplace_back(&resolver::run, this);
+    }
+
+    resolver::~resolver()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        queued_.notify_all();
+        for (auto &thread : threads_)
+            thread.join();
+
+        py::gil_scoped_acquire gil;
+        plugins_.clear();
+    }
+
+    void resolver::prefetch(const core::item &item)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (const auto &mirror : item.misc.mirrors)
+            enqueue({item.misc.origin_plugin, mirror}, false);
+    }
+
+    std::optional<resolution> resolver::resolve(const core::item &item, size_t mirror)
+    {
+        result res;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            res = enqueue({item.misc.origin_plugin, item.misc.mirrors[mirror]}, true);
+        }
+
+        return res.get();
+    }
+
+    bool resolver::ready(const core::item &item, size_t mirror)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return enqueue({item.misc.origin_plugin, item.misc.mirrors[mirror]}, false).wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready;
+    }
+
+    resolver::result resolver::enqueue(const key &k, bool urgent)
+    {
+        if (auto it = results_.find(k); it != results_.end()) {
+            if (!urgent || it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                return it->second;
+
+            /* Move it up, if it's still queued. */
+            const auto queued = std::find_if(queue_.begin(), queue_.end(), [&k](const auto &q) { return q.first == k; });
+            if (queued != queue_.end()) {
+                auto task = std::move(*queued);
+                queue_.erase(queued);
+                queue_.push_front(std::move(task));
+            }
+            return it->second;
+        }
+
+        std::promise<std::optional<resolution>> promise;
+        result res = promise.get_future().share();
+        results_.emplace(k, res);
+
+        if (urgent)
+            queue_.emplace_front(k, std::move(promise));
+        else
+            queue_.emplace_back(k, std::move(promise));
+        queued_.notify_one();
+
+        return res;
+    }
+
+    void resolver::run()
+    {
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+            if (stop_)
+                return;
+
+            auto [k, promise] = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+
+            auto res = load_cached(k);
+            if (!res) {
+                res = call_plugin(k);
+                if (res)
+                    store_cached(k, *res);
+            }
+            promise.set_value(std::move(res));
+        }
+    }
+
+    std::optional<resolution> resolver::call_plugin(const key &k)
+    {
+        const auto & [ origin, mirror ] = k;
+        const auto plugin = plugins_.find(origin);
+        if (plugin == plugins_.end())
+            return std::nullopt;
+
+        py::gil_scoped_acquire gil;
+        try {
+            py::object obj = plugin->second.attr("resolve")(mirror);
+            if (obj.is_none()) {
+                /* Function returned None; unable to resolve. */
+                return std::nullopt;
+            }
+
+            const auto pair = obj.cast<std::pair<string, py::dict>>();
+            resolution res{pair.first, {}};
+            for (const auto &header : pair.second) {
+                res.headers.push_back(
+                    fmt::format("{}: {}", py::str(header.first).cast<string>(), py::str(header.second).cast<string>()));
+            }
+
+            return res;
+        } catch (const py::error_already_set &) {
+            /* A plugin that fails to resolve a mirror has failed to resolve it. */
+            return std::nullopt;
+        } catch (const py::cast_error &) {
+            return std::nullopt;
+        }
+    }
+
+    fs::path resolver::path_of(const key &k) const
+    {
+        return cache_dir_ / fmt::format("{:016x}.mirror", std::hash<string>()(k.first + '\n' + k.second));
+    }
+
+    /*
+     * An entry is a text file of lines:
+     *   header, origin plugin, mirror, seconds since the epoch when written, resolved URL,
+     * followed by one line per HTTP header.
+     */
+    std::optional<resolution> resolver::load_cached(const key &k) const
+    {
+        if (cache_dir_.empty())
+            return std::nullopt;
+
+        std::ifstream in(path_of(k));
+        string line, origin, mirror, written;
+        if (!std::getline(in, line) || line != header || !std::getline(in, origin) || !std::getline(in, mirror) ||
+            !std::getline(in, written))
+            return std::nullopt;
+
+        /* A hash collision, or an expired entry. */
+        if (origin != k.first || mirror != k.second)
+            return std::nullopt;
+        try {
+            if (clock::now() - clock::time_point(std::chrono::seconds(std::stoll(written))) > ttl_)
+                return std::nullopt;
+        } catch (const std::logic_error &) {
+            return std::nullopt;
+        }
+
+        resolution res;
+        if (!std::getline(in, res.url) || res.url.empty())
+            return std::nullopt;
+        while (std::getline(in, line))
+            res.headers.push_back(line);
+
+        return res;
+    }
+
+    void resolver::store_cached(const key &k, const resolution &res) const
+    {
+        if (cache_dir_.empty())
+            return;
+
+        /* Written to a temporary file first, as other threads may be reading the entry. */
+        std::error_code ec;
+        fs::create_directories(cache_dir_, ec);
+        const auto path = path_of(k);
+        const auto tmp = fs::path(path).concat(fmt::format(".{:x}.tmp", std::hash<std::thread::id>()(std::this_thread::get_id())));
+
+        std::ofstream out(tmp, std::ios::trunc);
+        out << header << '\n' << k.first << '\n' << k.second << '\n';
+        out << std::chrono::duration_cast<std::chrono::seconds>(clock::now().time_since_epoch()).count() << '\n';
+        out << res.url << '\n';
+        for (const auto &h : res.headers)
+            out << h << '\n';
+        out.close();
+
+        /* A cache that can't be written is no worse than none. */
+        if (out)
+            fs::rename(tmp, path, ec);
+        else
+            fs::remove(tmp, ec);
+    }
+
+} // namespace bookwyrm
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <experimental/filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include "../common.hpp"
+#include "core/item.hpp"
+#include "python.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm {
+
+    /* Where a mirror leads, according to the plugin that found the item. */
+    struct resolution {
+        string url;
+
+        /* HTTP headers to send along, as "Name: value". */
+        vector<string> headers;
+    };
+
+    /*
+     * Resolves mirrors with the resolve() function of the plugin that found the item, on a few
+     * threads of its own, so that mirrors can be resolved while the user is still picking items.
+     * Resolved mirrors are cached on disk, so that a later run for the same item needn't ask again.
+     */
+    class resolver {
+    public:
+        /* Caching is disabled if cache_dir is empty. Requires the interpreter to outlive the resolver. */
+        explicit resolver(vector<py::module> plugins,
+                          fs::path cache_dir,
+                          std::chrono::seconds ttl = std::chrono::hours(1),
+                          size_t threads = 4);
+        ~resolver();
+
+        /* Start resolving all of the item's mirrors, unless they already are. */
+        void prefetch(const core::item &item);
+
+        /*
+         * Resolve one of the item's mirrors, waiting if it's still being resolved.
+         * Returns nothing if the plugin can't resolve it.
+         */
+        std::optional<resolution> resolve(const core::item &item, size_t mirror);
+
+        /* Whether resolve() would return without waiting. */
+        bool ready(const core::item &item, size_t mirror);
+
+    private:
+        /* The origin plugin and the mirror. */
+        using key = std::pair<string, string>;
+        using result = std::shared_future<std::optional<resolution>>;
+
+        /* Queue the mirror to be resolved, first if urgent. Requires mutex_. */
+        result enqueue(const key &k, bool urgent);
+
+        void run();
+
+        /* Call the plugin. */
+        std::optional<resolution> call_plugin(const key &k);
+
+        fs::path path_of(const key &k) const;
+        std::optional<resolution> load_cached(const key &k) const;
+        void store_cached(const key &k, const resolution &res) const;
+
+        /* The loaded plugins, by the file name items name as their origin. */
+        std::unordered_map<string, py::module> plugins_;
+
+        const fs::path cache_dir_;
+        const std::chrono::seconds ttl_;
+
+        std::mutex mutex_;
+        std::condition_variable queued_;
+        std::deque<std::pair<key, std::promise<std::optional<resolution>>>> queue_;
+        std::map<key, result> results_;
+        bool stop_ = false;
+
+        vector<std::thread> threads_;
+    };
+
+} // namespace bookwyrm
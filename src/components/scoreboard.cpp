@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include "scoreboard.hpp"
+
+namespace bookwyrm {
+
+    /* Bump when the format changes; files of other versions are ignored. */
+    static const string header = "bookwyrm-hosts 1";
+
+    /* A host is skipped once it has failed this many (decayed) attempts, nearly all of them. */
+    static constexpr double dead_attempts = 3, dead_ratio = 0.1;
+
+    /* The lowercased host of a mirror URL; the mirror itself if it isn't one. */
+    static string host_of(const string &mirror)
+    {
+        const auto scheme = mirror.find("://");
+        const size_t begin = scheme == string::npos ? 0 : scheme + 3;
+        string host = mirror.substr(begin, mirror.find_first_of("/?#", begin) - begin);
+
+        std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+        return host;
+    }
+
+    /*
+     * The file is a header line followed by a line per host of
+     *   host, attempts, successes, time to first byte, throughput, seconds since the epoch when updated,
+     * separated by spaces.
+     */
+    scoreboard::scoreboard(fs::path path, std::chrono::hours half_life) : path_(path), half_life_(half_life)
+    {
+        if (path_.empty())
+            return;
+
+        std::ifstream in(path_);
+        string line;
+        if (!std::getline(in, line) || line != header)
+            return;
+
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            string name;
+            host h;
+            long long updated;
+            if (fields >> name >> h.attempts >> h.successes >> h.ttfb >> h.rate >> updated) {
+                h.updated = clock::time_point(std::chrono::seconds(updated));
+                hosts_[name] = h;
+            }
+        }
+    }
+
+    scoreboard::host scoreboard::decayed(const host &h, clock::time_point now) const
+    {
+        const auto age = std::chrono::duration<double>(now - h.updated) / half_life_;
+        const double weight = std::pow(0.5, std::max(age, 0.0));
+
+        host d = h;
+        d.attempts *= weight;
+        d.successes *= weight;
+        d.updated = now;
+        return d;
+    }
+
+    scoreboard::host &scoreboard::update(const string &mirror)
+    {
+        auto &h = hosts_[host_of(mirror)];
+        h = decayed(h, clock::now());
+        h.attempts++;
+        dirty_ = true;
+        return h;
+    }
+
+    void scoreboard::succeeded(const string &mirror, double ttfb_seconds, double bytes_per_second)
+    {
+        auto &h = update(mirror);
+        h.successes++;
+
+        if (bytes_per_second <= 0)
+            return;
+        const bool first = h.rate <= 0;
+        h.ttfb = first ? ttfb_seconds : 0.7 * h.ttfb + 0.3 * ttfb_seconds;
+        h.rate = first ? bytes_per_second : 0.7 * h.rate + 0.3 * bytes_per_second;
+    }
+
+    void scoreboard::failed(const string &mirror)
+    {
+        update(mirror);
+    }
+
+    vector<size_t> scoreboard::order(const vector<string> &mirrors, std::int64_t size) const
+    {
+        /* Hosts without a successful transfer are assumed to be as fast as the average host that had one. */
+        double ttfb = 0, rate = 0;
+        size_t known = 0;
+        for (const auto & [ name, h ] : hosts_) {
+            if (h.rate > 0) {
+                ttfb += h.ttfb;
+                rate += h.rate;
+                known++;
+            }
+        }
+        ttfb = known > 0 ? ttfb / known : 1;
+        rate = known > 0 ? rate / known : 1;
+
+        /*
+         * Rank by successful downloads per second: the chance of success, by the time
+         * expected for the item. Ties, as between unknown hosts, keep the plugin's order.
+         */
+        const double bytes = size > 0 ? size : 1024 * 1024;
+        const auto now = clock::now();
+        vector<std::pair<size_t, double>> scores;
+        for (size_t i = 0; i < mirrors.size(); i++) {
+            const auto it = hosts_.find(host_of(mirrors[i]));
+            if (it == hosts_.end()) {
+                scores.emplace_back(i, 0.5 / (ttfb + bytes / rate));
+                continue;
+            }
+
+            const auto h = decayed(it->second, now);
+            if (h.attempts >= dead_attempts && h.successes < dead_ratio * h.attempts)
+                continue;
+
+            const double chance = (h.successes + 1) / (h.attempts + 2);
+            scores.emplace_back(i, h.rate > 0 ? chance / (h.ttfb + bytes / h.rate) : chance / (ttfb + bytes / rate));
+        }
+
+        vector<size_t> order;
+        if (scores.empty()) {
+            /* Every host is dead; they're all we have. */
+            for (size_t i = 0; i < mirrors.size(); i++)
+                order.push_back(i);
+            return order;
+        }
+
+        std::stable_sort(
+            scores.begin(), scores.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+        for (const auto & [ i, score ] : scores)
+            order.push_back(i);
+        return order;
+    }
+
+    void scoreboard::save()
+    {
+        if (path_.empty() || !dirty_)
+            return;
+
+        /* Written to a temporary file first, as another run may be reading it. */
+        std::error_code ec;
+        fs::create_directories(path_.parent_path(), ec);
+        const auto tmp = fs::path(path_).concat(".tmp");
+
+        std::ofstream out(tmp, std::ios::trunc);
+        out << header << '\n';
+        for (const auto & [ name, h ] : hosts_) {
+            out << name << ' ' << h.attempts << ' ' << h.successes << ' ' << h.ttfb << ' ' << h.rate << ' '
+                << std::chrono::duration_cast<std::chrono::seconds>(h.updated.time_since_epoch()).count() << '\n';
+        }
+        out.close();
+
+        /* A scoreboard that can't be written is no worse than none. */
+        if (out)
+            fs::rename(tmp, path_, ec);
+        else
+            fs::remove(tmp, ec);
+        dirty_ = false;
+    }
+
+} // namespace bookwyrm
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <unordered_map>
+
+#include "../common.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm {
+
+    /*
+     * Remembers how the hosts of mirrors have fared across runs: how often they served an item,
+     * how long they took to start, and how fast they were. Older observations count for less,
+     * halving in weight every half_life, so that a host that has recovered is tried again.
+     * Not thread-safe; the downloader uses it from its own thread only.
+     */
+    class scoreboard {
+    public:
+        /* Nothing is remembered across runs if path is empty. */
+        explicit scoreboard(fs::path path, std::chrono::hours half_life = std::chrono::hours(24 * 7));
+
+        /* A transfer from the mirror succeeded, with the time to its first byte and its throughput. */
+        void succeeded(const string &mirror, double ttfb_seconds, double bytes_per_second);
+
+        /* The mirror could not be resolved, or a transfer from it failed. */
+        void failed(const string &mirror);
+
+        /*
+         * The indices of the mirrors, most promising first, for an item of the given size, if known.
+         * Mirrors on hosts that keep failing are left out, unless all of them are.
+         */
+        vector<size_t> order(const vector<string> &mirrors, std::int64_t size) const;
+
+        /* Write the observations to disk, if any were made since the last save. */
+        void save();
+
+    private:
+        using clock = std::chrono::system_clock;
+
+        struct host {
+            /* Decayed counts. */
+            double attempts = 0, successes = 0;
+
+            /* Moving averages of successful transfers; zero until there has been one. */
+            double ttfb = 0, rate = 0;
+
+            clock::time_point updated;
+        };
+
+        /* The host as of now, its counts decayed since it was last updated. */
+        host decayed(const host &h, clock::time_point now) const;
+
+        host &update(const string &mirror);
+
+        const fs::path path_;
+        const std::chrono::hours half_life_;
+
+        std::unordered_map<string, host> hosts_;
+        bool dirty_ = false;
+    };
+
+} // namespace bookwyrm
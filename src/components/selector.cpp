@@ -0,0 +1,74 @@
+#include <algorithm>
+
+#include <fmt/format.h>
+
+#include "selector.hpp"
+
+namespace bookwyrm {
+
+    selector::selector(const core::item &wanted, selection_policy policy, bool log_debug)
+        : wanted_(wanted), policy_(std::move(policy)), log_debug_(log_debug)
+    {
+    }
+
+    std::optional<std::tuple<size_t, int, int>> selector::rank(const core::item &item) const
+    {
+        const auto &exts = policy_.extensions;
+        const size_t ext_rank = std::distance(exts.cbegin(), std::find(exts.cbegin(), exts.cend(), item.exacts.extension));
+
+        if (!exts.empty() && ext_rank == exts.size())
+            return std::nullopt;
+        if (policy_.max_size != core::empty && item.exacts.size != core::empty && item.exacts.size > policy_.max_size)
+            return std::nullopt;
+        if (policy_.min_year != core::empty && (item.exacts.year == core::empty || item.exacts.year < policy_.min_year))
+            return std::nullopt;
+
+        /* By preferred extension, then by score, then the most recent. */
+        return std::make_tuple(exts.empty() ? 0 : ext_rank, -static_cast<int>(item.score(wanted_)), -item.exacts.year);
+    }
+
+    void selector::found(const core::item &item)
+    {
+        const auto item_rank = rank(item);
+        if (!item_rank)
+            return;
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (confident_)
+            return;
+
+        if (!best_ || *item_rank < best_rank_) {
+            best_.emplace(item);
+            best_rank_ = *item_rank;
+        }
+
+        if (std::get<0>(*item_rank) == 0 && static_cast<unsigned int>(-std::get<1>(*item_rank)) >= policy_.confidence) {
+            confident_ = true;
+            changed_.notify_all();
+        }
+    }
+
+    void selector::update()
+    {
+        /* A plugin may have finished. */
+        std::lock_guard<std::mutex> guard(mutex_);
+        changed_.notify_all();
+    }
+
+    void selector::log(const core::log_level level, const std::string message)
+    {
+        if (!log_debug_ && level <= core::log_level::debug)
+            return;
+
+        fmt::print(stderr, "{}: {}\n", core::loglvl_to_string(level), message);
+    }
+
+    std::optional<core::item> selector::wait_for_pick(const core::backend &backend)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [this, &backend]() { return confident_ || backend.running_plugins() == 0; });
+
+        return best_;
+    }
+
+} // namespace bookwyrm
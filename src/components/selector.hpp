@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+
+#include "core/plugin_handler.hpp"
+
+namespace bookwyrm {
+
+    /* What the selector may pick, and when it is sure enough to pick without waiting for more. */
+    struct selection_policy {
+        /* Acceptable extensions, most preferred first. Any extension is acceptable if empty. */
+        vector<string> extensions;
+
+        /* In bytes. Items of unknown size are acceptable. */
+        int max_size = core::empty;
+
+        /* Items of unknown year are not acceptable if set. */
+        int min_year = core::empty;
+
+        /* Pick an item of the most preferred extension right away if it scores at least this. */
+        unsigned int confidence = 90;
+    };
+
+    /*
+     * A frontend that picks an item to download without any user interaction. Items are judged
+     * by the policy as they are found; a confident match is picked the moment it is found.
+     * Otherwise, the best acceptable item is picked once all plugins have finished.
+     * Log entries are written to stderr.
+     */
+    class selector : public core::frontend {
+    public:
+        explicit selector(const core::item &wanted, selection_policy policy, bool log_debug);
+
+        void update() override;
+        void log(const core::log_level level, const std::string message) override;
+        void found(const core::item &item) override;
+
+        /*
+         * Block until a confident match has been found, or until the backend has no running
+         * plugins left. Returns the picked item, if any acceptable item was found.
+         */
+        std::optional<core::item> wait_for_pick(const core::backend &backend);
+
+    private:
+        /* Lower is better; nothing if the item isn't acceptable at all. */
+        std::optional<std::tuple<size_t, int, int>> rank(const core::item &item) const;
+
+        const core::item wanted_;
+        const selection_policy policy_;
+        const bool log_debug_;
+
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::optional<core::item> best_;
+        std::tuple<size_t, int, int> best_rank_;
+        bool confident_ = false;
+    };
+
+} // namespace bookwyrm
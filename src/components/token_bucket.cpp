@@ -0,0 +1,29 @@
+#include <algorithm>
+
+#include "token_bucket.hpp"
+
+namespace bookwyrm {
+
+    token_bucket::token_bucket(std::int64_t rate, std::int64_t burst)
+        : rate_(rate), burst_(burst), tokens_(burst), refilled_(std::chrono::steady_clock::now())
+    {
+    }
+
+    bool token_bucket::available()
+    {
+        if (unlimited())
+            return true;
+
+        const auto now = std::chrono::steady_clock::now();
+        tokens_ = std::min<double>(tokens_ + rate_ * std::chrono::duration<double>(now - refilled_).count(), burst_);
+        refilled_ = now;
+        return tokens_ > 0;
+    }
+
+    void token_bucket::take(std::int64_t tokens)
+    {
+        if (!unlimited())
+            tokens_ -= tokens;
+    }
+
+} // namespace bookwyrm
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "../common.hpp"
+
+namespace bookwyrm {
+
+    /*
+     * Limits a rate by handing out tokens, refilled at the rate up to a burst's worth.
+     * Tokens may be taken while any are left, even more than there are: the debt is
+     * paid off before more are handed out.
+     */
+    class token_bucket {
+    public:
+        /* Per second. Never runs out if rate is zero. */
+        explicit token_bucket(std::int64_t rate, std::int64_t burst);
+
+        bool unlimited() const { return rate_ == 0; }
+
+        /* Whether any tokens are left, after refilling. */
+        bool available();
+
+        void take(std::int64_t tokens);
+
+    private:
+        const std::int64_t rate_, burst_;
+        double tokens_;
+        std::chrono::steady_clock::time_point refilled_;
+    };
+
+} // namespace bookwyrm
@@ -0,0 +1,47 @@
+#include <fmt/format.h>
+
+#include "batch.hpp"
+#include "hash.hpp"
+
+using namespace bookwyrm::core;
+
+batch_query::batch_query(size_t id, const item &wanted, plugin_handler &ph) : id(id), wanted(wanted), ph_(ph)
+{
+}
+
+void batch_query::add_item(py::dict dict)
+{
+    const item item(dict);
+    ph_.catalog_item(item);
+
+    if (item.nonexacts.title.empty() || !item.matches(wanted, ph_.options_.accuracy) || item.misc.uris.size() == 0)
+        return;
+
+    if (!insert_item(item))
+        log(log_level::debug, "ignored one too similar item");
+}
+
+bool batch_query::insert_item(const item &item)
+{
+    std::lock_guard<std::mutex> guard(items_mutex_);
+
+    const size_t hash = std::hash<core::item>()(item);
+    if (!seen_.insert(hash).second) {
+        stale_.erase(hash);
+        return false;
+    }
+
+    items_.push_back(item);
+    return true;
+}
+
+void batch_query::log(log_level lvl, std::string msg)
+{
+    ph_.log(lvl, fmt::format("search {}: {}", id + 1, msg));
+}
+
+vector<item> batch_query::results() const
+{
+    std::lock_guard<std::mutex> guard(items_mutex_);
+    return items_;
+}
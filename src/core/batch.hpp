@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
+#include "item.hpp"
+#include "plugin_handler.hpp"
+#include "python.hpp"
+
+namespace bookwyrm::core {
+
+    /*
+     * One search of a batch run by plugin_handler::batch_search(). Plugins are handed a
+     * batch_query instead of the plugin_handler, and feed it the same way.
+     */
+    class __attribute__((visibility("hidden"))) batch_query {
+    public:
+        explicit batch_query(size_t id, const item &wanted, plugin_handler &ph);
+        explicit batch_query(const batch_query &) = delete;
+
+        /* Try to add a found item. Bound to Python as feed(). */
+        void add_item(py::dict dict);
+
+        /* Log a message through the plugin handler, marked with which search it concerns. */
+        void log(log_level lvl, std::string msg);
+
+        /* The found items, in the order they were found. */
+        vector<item> results() const;
+
+        /* Did every plugin run for this search finish successfully? */
+        bool complete() const { return !plugin_failed_; }
+
+        /* The position of this search in the batch. */
+        const size_t id;
+
+        const item wanted;
+
+    private:
+        friend class plugin_handler;
+
+        /* Add a matched item, unless an equal item has already been found. */
+        bool insert_item(const item &item);
+
+        plugin_handler &ph_;
+
+        vector<item> items_;
+        std::unordered_set<size_t> seen_, stale_;
+        mutable std::mutex items_mutex_;
+
+        size_t cache_key_ = 0;
+        std::atomic<size_t> running_plugins_{0};
+        std::atomic<bool> plugin_failed_{false};
+    };
+
+} // namespace bookwyrm::core
@@ -1,6 +1,14 @@
+#include <chrono>
+#include <map>
+#include <optional>
+
 #include <fmt/format.h>
 
 #include "../../string.hpp"
+#include "../batch.hpp"
+#include "../html.hpp"
+#include "../http_client.hpp"
+#include "../http_share.hpp"
 #include "../item.hpp"
 #include "../plugin_handler.hpp"
 #include "../python.hpp"
@@ -11,18 +19,41 @@ using std::vector;
 
 namespace detail {
 
-    struct __attribute__((visibility("hidden"))) log_wrapper {
+    /* Wraps whatever a plugin was handed as its bookwyrm instance: a plugin_handler or a batch_query. */
+    template <typename T> struct __attribute__((visibility("hidden"))) log_wrapper {
     public:
-        explicit log_wrapper(core::plugin_handler *instance) : ph_(instance) { assert(ph_ != nullptr); }
+        explicit log_wrapper(T *instance) : ph_(instance) { assert(ph_ != nullptr); }
 
         void debug(const std::string &msg) { ph_->log(core::log_level::debug, msg); }
         void warn(const std::string &msg) { ph_->log(core::log_level::warn, msg); }
         void error(const std::string &msg) { ph_->log(core::log_level::err, msg); }
 
     private:
-        core::plugin_handler *ph_;
+        T *ph_;
     };
 
+    template <typename T> void feed(T &instance, py::dict dict)
+    {
+        /* Find the base name of the plugin calling this function. */
+        auto sys = py::module::import("sys");
+        auto os = py::module::import("os");
+        py::str filepath = sys.attr("_getframe")(0).attr("f_code").attr("co_filename");
+        py::str basename = os.attr("path").attr("basename")(filepath);
+
+        dict["origin_plugin"] = basename;
+        instance.add_item(std::move(dict));
+    }
+
+    template <typename T> log_wrapper<T> getattr(T &instance, const std::string &key)
+    {
+        /* TODO: Don't create a new wrapper instance every time */
+        if (key == "log") {
+            return log_wrapper<T>(&instance);
+        }
+
+        throw std::invalid_argument(std::string("AttributeError: no item attribute with key '") + key + "'");
+    }
+
     py::dict to_py_dict(const core::item &item)
     {
         py::dict dict;
@@ -56,6 +87,117 @@ namespace detail {
         return dict;
     }
 
+    /* The client all plugins share, created on first use. */
+    core::http_client &http()
+    {
+        static core::http_client client;
+        return client;
+    }
+
+    vector<string> header_lines(const std::map<string, string> &headers)
+    {
+        vector<string> lines;
+        for (const auto & [ name, value ] : headers)
+            lines.push_back(fmt::format("{}: {}", name, value));
+
+        return lines;
+    }
+
+    /* Invalid UTF-8 is replaced rather than raised about. */
+    py::str utf8(const string &str)
+    {
+        return py::reinterpret_steal<py::str>(PyUnicode_DecodeUTF8(str.data(), str.size(), "replace"));
+    }
+
+    /* Each table as a list of rows, each row a list of (text, links) cells, each link an (attributes, fragments) pair. */
+    py::list to_py_tables(const vector<core::html::table> &tables)
+    {
+        py::list py_tables;
+        for (const auto &table : tables) {
+            py::list rows;
+            for (const auto &row : table.rows) {
+                py::list cells;
+                for (const auto &cell : row) {
+                    py::list links;
+                    for (const auto &link : cell.links) {
+                        py::dict attrs;
+                        for (const auto & [ name, value ] : link.attrs)
+                            attrs[utf8(name)] = utf8(value);
+
+                        py::list fragments;
+                        for (const auto &fragment : link.fragments)
+                            fragments.append(utf8(fragment));
+
+                        links.append(py::make_tuple(attrs, fragments));
+                    }
+                    cells.append(py::make_tuple(utf8(cell.text), links));
+                }
+                rows.append(cells);
+            }
+            py_tables.append(rows);
+        }
+
+        return py_tables;
+    }
+
+    py::dict response_headers(const core::http_response &response)
+    {
+        py::dict dict;
+        for (const auto & [ name, value ] : response.headers)
+            dict[py::str(name)] = value;
+
+        return dict;
+    }
+
+    /* The body, decoded as its Content-Type says, or else as UTF-8. */
+    py::str response_text(const core::http_response &response)
+    {
+        const py::bytes body(response.body);
+        for (const auto & [ name, value ] : response.headers) {
+            if (const auto charset = value.find("charset="); name == "content-type" && charset != string::npos) {
+                try {
+                    return body.attr("decode")(value.substr(charset + 8, value.find(';', charset) - charset - 8), "replace");
+                } catch (const py::error_already_set &) {
+                    /* An encoding Python doesn't know of. */
+                }
+            }
+        }
+
+        return body.attr("decode")("utf-8", "replace");
+    }
+
+    void raise_for_status(const core::http_response &response)
+    {
+        if (response.status >= 400)
+            throw core::http_error(fmt::format("{}: HTTP {}", response.url, response.status));
+    }
+
+    /* A response that may not have arrived yet. */
+    struct pending_response {
+        core::http_client::result result;
+
+        bool done() const { return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+
+        /* Wait for the response without holding the GIL. */
+        core::http_response get(std::optional<double> timeout) const
+        {
+            bool ready = true;
+            {
+                py::gil_scoped_release nogil;
+                if (timeout)
+                    ready = result.wait_for(std::chrono::duration<double>(*timeout)) == std::future_status::ready;
+                else
+                    result.wait();
+            }
+
+            if (!ready) {
+                PyErr_SetString(PyExc_TimeoutError, "the response has not arrived yet");
+                throw py::error_already_set();
+            }
+            return result.get();
+        }
+    };
+
 } // namespace detail
 
 PYBIND11_MODULE(pybookwyrm, m)
@@ -76,28 +218,93 @@ PYBIND11_MODULE(pybookwyrm, m)
 
     /* core::plugin_handler bindings */
 
-    py::class_<detail::log_wrapper>(m, "log")
-        .def("debug", &detail::log_wrapper::debug)
-        .def("warn", &detail::log_wrapper::warn)
-        .def("error", &detail::log_wrapper::error);
+    py::class_<detail::log_wrapper<core::plugin_handler>>(m, "log")
+        .def("debug", &detail::log_wrapper<core::plugin_handler>::debug)
+        .def("warn", &detail::log_wrapper<core::plugin_handler>::warn)
+        .def("error", &detail::log_wrapper<core::plugin_handler>::error);
 
     py::class_<core::plugin_handler>(m, "bookwyrm")
-        .def("feed", [&m](core::plugin_handler &ph, py::dict dict) {
-            /* Find the base name of the plugin calling this function. */
-            auto sys = py::module::import("sys");
-            auto os = py::module::import("os");
-            py::str filepath = sys.attr("_getframe")(0).attr("f_code").attr("co_filename");
-            py::str basename = os.attr("path").attr("basename")(filepath);
-
-            dict["origin_plugin"] = basename;
-            ph.add_item(std::move(dict));
-        })
-        .def("__getattr__", [&](core::plugin_handler &ph, const std::string &key) {
-            /* TODO: Don't create a new wrapper instance every time */
-            if (key == "log") {
-                return detail::log_wrapper(&ph);
-            }
+        .def("feed", &detail::feed<core::plugin_handler>)
+        .def("__getattr__", &detail::getattr<core::plugin_handler>);
+
+    /* core::batch_query bindings; handed to plugins in place of a plugin_handler in batch mode */
+
+    py::class_<detail::log_wrapper<core::batch_query>>(m, "query_log")
+        .def("debug", &detail::log_wrapper<core::batch_query>::debug)
+        .def("warn", &detail::log_wrapper<core::batch_query>::warn)
+        .def("error", &detail::log_wrapper<core::batch_query>::error);
+
+    py::class_<core::batch_query>(m, "query")
+        .def("feed", &detail::feed<core::batch_query>)
+        .def("__getattr__", &detail::getattr<core::batch_query>);
+
+    /* core::http_client bindings; one client is shared by all plugins */
+
+    auto http = m.def_submodule("http", "fetch pages over connections shared by all plugins");
+
+    py::register_exception<core::http_error>(http, "error", PyExc_IOError);
+
+    py::class_<core::http_response>(http, "response")
+        .def_readonly("status", &core::http_response::status)
+        .def_readonly("url", &core::http_response::url)
+        .def_property_readonly("headers", &detail::response_headers)
+        .def_property_readonly("content", [](const core::http_response &r) { return py::bytes(r.body); })
+        .def_property_readonly("text", &detail::response_text)
+        .def_readonly("from_cache", &core::http_response::cached)
+        .def("raise_for_status", &detail::raise_for_status);
+
+    py::class_<detail::pending_response>(http, "pending")
+        .def("done", &detail::pending_response::done)
+        .def("result", &detail::pending_response::get, py::arg("timeout") = py::none());
+
+    http.def("fetch",
+             [](const string &url, const std::map<string, string> &headers) {
+                 return detail::pending_response{detail::http().fetch(url, detail::header_lines(headers))};
+             },
+             "Start fetching the URL and return at once",
+             py::arg("url"),
+             py::arg("headers") = std::map<string, string>{});
+
+    http.def("get",
+             [](const string &url, const std::map<string, string> &headers) {
+                 const auto result = detail::http().fetch(url, detail::header_lines(headers));
+                 py::gil_scoped_release nogil;
+                 return result.get();
+             },
+             "Fetch the URL and wait for the response",
+             py::arg("url"),
+             py::arg("headers") = std::map<string, string>{});
+
+    http.def("cache",
+             [](const string &dir, uintmax_t max_size, bool revalidate) {
+                 detail::http().cache_to(dir, max_size, revalidate);
+             },
+             "Cache responses in the directory from now on, keeping at most max_size bytes there; "
+             "with revalidate, ask the server whether each has changed before serving it",
+             py::arg("dir"),
+             py::arg("max_size") = uintmax_t{64} << 20,
+             py::arg("revalidate") = false);
+
+    http.def("share",
+             [](py::capsule share) { detail::http().share_with(*static_cast<std::shared_ptr<core::http_share> *>(share)); },
+             "Share DNS lookups and TLS sessions with the host program; takes the capsule it hands over",
+             py::arg("share"));
+
+    /* core::html bindings */
+
+    auto html = m.def_submodule("html", "extract the tables of HTML documents");
 
-            throw std::invalid_argument(std::string("AttributeError: no item attribute with key '") + key + "'");
-        });
+    html.def("tables",
+             [](const string &document, const std::map<string, string> &attrs) {
+                 vector<core::html::table> tables;
+                 {
+                     py::gil_scoped_release nogil;
+                     tables = core::html::tables(document, core::html::attributes(attrs.cbegin(), attrs.cend()));
+                 }
+                 return detail::to_py_tables(tables);
+             },
+             "The tables of the document with all of the given attributes, as lists of rows of "
+             "(text, [(attributes, fragments)]) cells",
+             py::arg("document"),
+             py::arg("attrs") = std::map<string, string>{});
 }
@@ -0,0 +1,106 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "cache.hpp"
+#include "serialize.hpp"
+
+namespace bookwyrm::core {
+
+    /*
+     * Entry layout (host byte order):
+     *   magic    4 bytes, "bwrc"
+     *   version  uint32_t, bumped whenever the layout or the item encoding changes
+     *   written  int64_t, seconds since the epoch
+     *   count    uint32_t
+     * followed by `count` encoded items.
+     */
+    constexpr char magic[4] = {'b', 'w', 'r', 'c'};
+    constexpr uint32_t version = 2;
+
+    using clock = std::chrono::system_clock;
+
+    template <typename T> static void put(string &buf, T value)
+    {
+        buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T> static T get(std::string_view &data)
+    {
+        if (data.size() < sizeof(T))
+            throw std::runtime_error("truncated cache entry");
+
+        T value;
+        std::memcpy(&value, data.data(), sizeof(T));
+        data.remove_prefix(sizeof(T));
+        return value;
+    }
+
+    fs::path result_cache::path_of(size_t key) const { return dir_ / fmt::format("{:016x}.results", key); }
+
+    std::optional<vector<item>> result_cache::load(size_t key) const
+    {
+        std::ifstream file(path_of(key), std::ios::binary);
+        if (!file)
+            return std::nullopt;
+
+        const string contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        std::string_view data = contents;
+
+        try {
+            if (data.size() < sizeof(magic) || std::memcmp(data.data(), magic, sizeof(magic)) != 0)
+                return std::nullopt;
+            data.remove_prefix(sizeof(magic));
+
+            if (get<uint32_t>(data) != version)
+                return std::nullopt;
+
+            const clock::time_point written{std::chrono::seconds(get<int64_t>(data))};
+            if (clock::now() - written > ttl_)
+                return std::nullopt;
+
+            vector<item> items;
+            for (auto count = get<uint32_t>(data); count > 0; count--) {
+                const auto len = serialize::record_length(data);
+                if (len < serialize::header_size || len > data.size())
+                    throw std::runtime_error("truncated cache entry");
+
+                items.push_back(serialize::decode(data.substr(0, len)));
+                data.remove_prefix(len);
+            }
+
+            return items;
+        } catch (const std::runtime_error &) {
+            /* A corrupt entry is as good as a missing one; it will be overwritten. */
+            return std::nullopt;
+        }
+    }
+
+    void result_cache::store(size_t key, const vector<item> &items) const
+    {
+        string buf(magic, sizeof(magic));
+        put(buf, version);
+        put(buf, static_cast<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(clock::now().time_since_epoch()).count()));
+        put(buf, static_cast<uint32_t>(items.size()));
+
+        for (const auto &item : items)
+            serialize::encode(item, buf);
+
+        /* Write to a temporary file first, so that a concurrent load() never sees half an entry. */
+        fs::create_directories(dir_);
+        const auto path = path_of(key), tmp = fs::path(path).concat(".tmp");
+
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(buf.data(), buf.size());
+        file.close();
+        if (!file)
+            throw std::runtime_error(fmt::format("unable to write cache entry {}", tmp.string()));
+
+        fs::rename(tmp, path);
+    }
+
+} // namespace bookwyrm::core
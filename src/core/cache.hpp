@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+#include <experimental/filesystem>
+#include <optional>
+
+#include "item.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm::core {
+
+    /*
+     * An on-disk cache of search results.
+     *
+     * Each entry is a single file in the cache directory, named after its key, holding the time
+     * it was written and all found items in their serialized form. The key is expected to
+     * identify the wanted item, the search accuracy and the versions of all loaded plugins;
+     * see plugin_handler::load_plugins().
+     */
+    class result_cache {
+    public:
+        explicit result_cache(const fs::path &dir, std::chrono::seconds ttl) : dir_(dir), ttl_(ttl) {}
+
+        /* Returns the items cached under the key, unless there are none or they have expired. */
+        std::optional<vector<item>> load(size_t key) const;
+
+        /*
+         * Cache the items under the key, replacing any previous entry.
+         * Throws std::runtime_error if the entry could not be written.
+         */
+        void store(size_t key, const vector<item> &items) const;
+
+    private:
+        fs::path path_of(size_t key) const;
+
+        const fs::path dir_;
+        const std::chrono::seconds ttl_;
+    };
+
+} // namespace bookwyrm::core
@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "catalog.hpp"
+#include "hash.hpp"
+#include "serialize.hpp"
+
+namespace bookwyrm::core {
+
+    /*
+     * The items file starts with a header of 4 magic bytes, "bwcl", and a uint32_t version,
+     * followed by a sequence of encoded items; each record carries its own length.
+     * A torn record at the end (e.g. from a crash mid-write) is cut off when the catalog is opened,
+     * and a file of another version is started afresh.
+     *
+     * The index file layout (host byte order):
+     *   magic         4 bytes, "bwci"
+     *   version       uint32_t
+     *   records       uint32_t, how many item records were indexed
+     *   trigrams      uint32_t
+     *   ids           uint32_t, total length of all posting lists
+     *   entries       `trigrams` times {uint32_t trigram, uint32_t first, uint32_t count}, sorted by trigram
+     *   postings      `ids` times uint32_t record id; entry i owns [first, first + count)
+     *   hashes        `records` times uint64_t, the hash of each item, in record order
+     * An index that does not cover exactly the records in the items file is rebuilt.
+     */
+    constexpr char index_magic[4] = {'b', 'w', 'c', 'i'};
+    constexpr uint32_t index_version = 2;
+    constexpr char items_magic[4] = {'b', 'w', 'c', 'l'};
+    constexpr uint32_t items_version = 1;
+    constexpr size_t items_header_size = sizeof(items_magic) + sizeof(uint32_t);
+    constexpr size_t header_size = 4 * sizeof(uint32_t) + sizeof(index_magic), entry_size = 3 * sizeof(uint32_t);
+
+    /* Added records are written in batches of at least this many bytes. */
+    constexpr size_t flush_threshold = 1 << 16;
+
+    template <typename T> static T read_at(const char *base, size_t offset)
+    {
+        T value;
+        std::memcpy(&value, base + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T> static void write(std::ofstream &out, T value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static std::runtime_error system_error(const string &what, const fs::path &path)
+    {
+        return std::runtime_error(fmt::format("{} {}: {}", what, path.string(), std::strerror(errno)));
+    }
+
+    /* Lowercase all ASCII letters and digits, and collapse everything else ASCII to single spaces. */
+    static string normalize(const string &str)
+    {
+        string norm = " ";
+        for (const char ch : str) {
+            const auto uch = static_cast<unsigned char>(ch);
+            if (uch >= 0x80 || std::isalnum(uch))
+                norm += static_cast<char>(std::tolower(uch));
+            else if (norm.back() != ' ')
+                norm += ' ';
+        }
+
+        if (norm.back() != ' ')
+            norm += ' ';
+        return norm;
+    }
+
+    static void add_trigrams(const string &str, vector<uint32_t> &trigrams)
+    {
+        const auto norm = normalize(str);
+        for (size_t i = 0; i + 3 <= norm.size(); i++) {
+            const auto byte = [&norm](size_t j) { return static_cast<uint32_t>(static_cast<unsigned char>(norm[j])); };
+            trigrams.push_back(byte(i) << 16 | byte(i + 1) << 8 | byte(i + 2));
+        }
+    }
+
+    /* The unique trigrams of all indexed fields of an item. */
+    static vector<uint32_t> trigrams_of(const item &item)
+    {
+        vector<uint32_t> trigrams;
+        add_trigrams(item.nonexacts.title, trigrams);
+        add_trigrams(item.nonexacts.series, trigrams);
+        for (const auto &author : item.nonexacts.authors)
+            add_trigrams(author, trigrams);
+
+        std::sort(trigrams.begin(), trigrams.end());
+        trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+        return trigrams;
+    }
+
+    catalog::catalog(const fs::path &path) : path_(path)
+    {
+        fs::create_directories(path_);
+        open_items();
+        open_index();
+    }
+
+    catalog::~catalog()
+    {
+        try {
+            close();
+        } catch (const std::exception &) {
+            /* Nothing to be done; the index is rebuilt on next open. */
+        }
+
+        if (items_map_ != nullptr)
+            munmap(const_cast<char *>(items_map_), items_map_size_);
+        if (index_map_ != nullptr)
+            munmap(const_cast<char *>(index_map_), index_map_size_);
+        if (items_fd_ != -1)
+            ::close(items_fd_);
+    }
+
+    void catalog::open_items()
+    {
+        const auto items_path = path_ / "items";
+        items_fd_ = open(items_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (items_fd_ == -1)
+            throw system_error("unable to open catalog", items_path);
+
+        /* Another bookwyrm may be adding to the catalog; if so, we only read from it. */
+        writable_ = flock(items_fd_, LOCK_EX | LOCK_NB) == 0;
+
+        char header[items_header_size];
+        const bool compatible = pread(items_fd_, header, sizeof(header), 0) == sizeof(header) &&
+                                std::memcmp(header, items_magic, sizeof(items_magic)) == 0 &&
+                                read_at<uint32_t>(header, sizeof(items_magic)) == items_version;
+
+        if (!compatible && writable_) {
+            if (ftruncate(items_fd_, 0) != 0)
+                throw system_error("unable to reset catalog", items_path);
+
+            pending_.assign(items_magic, sizeof(items_magic));
+            pending_.append(reinterpret_cast<const char *>(&items_version), sizeof(items_version));
+            flush();
+        }
+
+        struct stat st;
+        if (fstat(items_fd_, &st) != 0)
+            throw system_error("unable to stat catalog", items_path);
+        items_map_size_ = st.st_size;
+
+        if (items_map_size_ > 0) {
+            void *map = mmap(nullptr, items_map_size_, PROT_READ, MAP_SHARED, items_fd_, 0);
+            if (map == MAP_FAILED)
+                throw system_error("unable to map catalog", items_path);
+            items_map_ = static_cast<const char *>(map);
+        }
+
+        /* A read-only catalog of another version is as good as an empty one. */
+        uint64_t offset = compatible || writable_ ? items_header_size : items_map_size_;
+        while (offset < items_map_size_) {
+            const auto len = serialize::record_length({items_map_ + offset, items_map_size_ - offset});
+            if (len < serialize::header_size || offset + len > items_map_size_)
+                break;
+
+            records_.emplace_back(offset, len);
+            offset += len;
+        }
+
+        if (offset != items_map_size_ && writable_ && ftruncate(items_fd_, offset) != 0)
+            throw system_error("unable to truncate torn record in catalog", items_path);
+
+        items_size_ = offset;
+        count_ = records_.size();
+    }
+
+    void catalog::open_index()
+    {
+        const auto index_path = path_ / "index";
+        const int fd = open(index_path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            rebuild_index();
+            return;
+        }
+
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= header_size)
+            map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (map == MAP_FAILED) {
+            rebuild_index();
+            return;
+        }
+
+        index_map_ = static_cast<const char *>(map);
+        index_map_size_ = st.st_size;
+
+        const auto records = read_at<uint32_t>(index_map_, 8), trigrams = read_at<uint32_t>(index_map_, 12),
+                   ids = read_at<uint32_t>(index_map_, 16);
+        const size_t expected_size = header_size + size_t(trigrams) * entry_size + size_t(ids) * sizeof(uint32_t) +
+                                     size_t(records) * sizeof(uint64_t);
+
+        if (std::memcmp(index_map_, index_magic, sizeof(index_magic)) != 0 ||
+            read_at<uint32_t>(index_map_, 4) != index_version || records != records_.size() ||
+            expected_size != index_map_size_) {
+            munmap(map, index_map_size_);
+            index_map_ = nullptr;
+            index_map_size_ = 0;
+            rebuild_index();
+            return;
+        }
+
+        indexed_trigrams_ = trigrams;
+
+        const size_t hashes_at = index_map_size_ - size_t(records) * sizeof(uint64_t);
+        hashes_.reserve(records);
+        for (size_t i = 0; i < records; i++)
+            hashes_.insert(read_at<uint64_t>(index_map_, hashes_at + i * sizeof(uint64_t)));
+    }
+
+    void catalog::rebuild_index()
+    {
+        for (record_id id = 0; id < records_.size(); id++) {
+            const auto & [ offset, len ] = records_[id];
+
+            try {
+                const auto item = serialize::decode({items_map_ + offset, len}, 0);
+                const size_t hash = std::hash<core::item>()(item);
+                hashes_.insert(hash);
+                delta_hashes_.push_back(hash);
+                index_item(item, id);
+            } catch (const std::runtime_error &) {
+                /* An undecodable record can never be found; keep the ids aligned nonetheless. */
+                delta_hashes_.push_back(0);
+            }
+        }
+
+        index_stale_ = true;
+    }
+
+    void catalog::index_item(const item &item, record_id id)
+    {
+        for (const auto tri : trigrams_of(item))
+            delta_[tri].push_back(id);
+    }
+
+    vector<catalog::record_id> catalog::postings(trigram tri) const
+    {
+        vector<record_id> ids;
+
+        if (index_map_ != nullptr) {
+            /* Binary search the sorted entries. */
+            size_t lo = 0, hi = indexed_trigrams_;
+            while (lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                const auto at = header_size + mid * entry_size;
+
+                if (const auto got = read_at<uint32_t>(index_map_, at); got < tri) {
+                    lo = mid + 1;
+                } else if (got > tri) {
+                    hi = mid;
+                } else {
+                    const auto first = read_at<uint32_t>(index_map_, at + 4), count = read_at<uint32_t>(index_map_, at + 8);
+                    const auto postings_at = header_size + indexed_trigrams_ * entry_size;
+                    for (size_t i = first; i < size_t(first) + count; i++)
+                        ids.push_back(read_at<uint32_t>(index_map_, postings_at + i * sizeof(uint32_t)));
+                    break;
+                }
+            }
+        }
+
+        if (const auto delta = delta_.find(tri); delta != delta_.cend())
+            ids.insert(ids.end(), delta->second.cbegin(), delta->second.cend());
+
+        return ids;
+    }
+
+    vector<item> catalog::find(const item &wanted, const unsigned int fuzzy_min) const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        /* Only records that were on disk when the catalog was opened can be read back. */
+        vector<record_id> candidates;
+        const auto wanted_trigrams = trigrams_of(wanted);
+
+        if (wanted_trigrams.empty()) {
+            /* Nothing indexed is wanted (e.g. only a publisher); consider everything. */
+            candidates.resize(records_.size());
+            std::iota(candidates.begin(), candidates.end(), 0);
+        } else {
+            /*
+             * Fuzzy matching is expensive, so only consider items that share at least a third of
+             * the wanted trigrams; anything less is very unlikely to pass item::matches().
+             */
+            std::unordered_map<record_id, size_t> hits;
+            for (const auto tri : wanted_trigrams) {
+                for (const auto id : postings(tri))
+                    hits[id]++;
+            }
+
+            const size_t threshold = std::max<size_t>(1, wanted_trigrams.size() / 3);
+            for (const auto & [ id, count ] : hits) {
+                if (count >= threshold && id < records_.size())
+                    candidates.push_back(id);
+            }
+
+            /* Keep the order in which the items were cataloged. */
+            std::sort(candidates.begin(), candidates.end());
+        }
+
+        vector<item> found;
+        for (const auto id : candidates) {
+            const auto & [ offset, len ] = records_[id];
+
+            try {
+                auto item = serialize::decode({items_map_ + offset, len});
+                if (item.matches(wanted, fuzzy_min))
+                    found.push_back(std::move(item));
+            } catch (const std::runtime_error &) {
+                continue;
+            }
+        }
+
+        return found;
+    }
+
+    void catalog::add(const item &item)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        if (closed_ || !writable_)
+            return;
+
+        const size_t hash = std::hash<core::item>()(item);
+        if (!hashes_.insert(hash).second)
+            return;
+
+        serialize::encode(item, pending_);
+
+        index_item(item, count_++);
+        delta_hashes_.push_back(hash);
+
+        if (pending_.size() >= flush_threshold)
+            flush();
+    }
+
+    void catalog::flush()
+    {
+        const char *data = pending_.data();
+        size_t left = pending_.size();
+
+        while (left > 0) {
+            const ssize_t written = ::write(items_fd_, data, left);
+            if (written == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw system_error("unable to write to catalog", path_ / "items");
+            }
+
+            data += written;
+            left -= written;
+        }
+
+        items_size_ += pending_.size();
+        pending_.clear();
+    }
+
+    void catalog::write_index()
+    {
+        if (delta_.empty() && !index_stale_)
+            return;
+
+        /* Merge the trigrams of the index file with those added since. */
+        vector<trigram> trigrams;
+        for (size_t i = 0; i < indexed_trigrams_; i++)
+            trigrams.push_back(read_at<uint32_t>(index_map_, header_size + i * entry_size));
+        for (const auto & [ tri, ids ] : delta_) {
+            std::ignore = ids;
+            trigrams.push_back(tri);
+        }
+        std::sort(trigrams.begin(), trigrams.end());
+        trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+        vector<vector<record_id>> lists;
+        lists.reserve(trigrams.size());
+        size_t ids = 0;
+        for (const auto tri : trigrams) {
+            lists.push_back(postings(tri));
+            ids += lists.back().size();
+        }
+
+        const auto index_path = path_ / "index", tmp = fs::path(index_path).concat(".tmp");
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+
+        out.write(index_magic, sizeof(index_magic));
+        for (const auto value : {index_version,
+                                 static_cast<uint32_t>(count_),
+                                 static_cast<uint32_t>(trigrams.size()),
+                                 static_cast<uint32_t>(ids)})
+            write(out, value);
+
+        uint32_t first = 0;
+        for (size_t i = 0; i < trigrams.size(); i++) {
+            write(out, trigrams[i]);
+            write(out, first);
+            write(out, static_cast<uint32_t>(lists[i].size()));
+            first += lists[i].size();
+        }
+
+        for (const auto &list : lists)
+            out.write(reinterpret_cast<const char *>(list.data()), list.size() * sizeof(record_id));
+
+        if (index_map_ != nullptr) {
+            const size_t indexed_records = read_at<uint32_t>(index_map_, 8);
+            out.write(index_map_ + index_map_size_ - indexed_records * sizeof(uint64_t),
+                      indexed_records * sizeof(uint64_t));
+        }
+        out.write(reinterpret_cast<const char *>(delta_hashes_.data()), delta_hashes_.size() * sizeof(uint64_t));
+
+        out.close();
+        if (!out)
+            throw std::runtime_error(fmt::format("unable to write catalog index {}", tmp.string()));
+
+        fs::rename(tmp, index_path);
+    }
+
+    void catalog::close()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+
+        if (closed_)
+            return;
+        closed_ = true;
+
+        if (writable_) {
+            flush();
+            write_index();
+        }
+    }
+
+    size_t catalog::size() const
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return count_;
+    }
+
+} // namespace bookwyrm::core
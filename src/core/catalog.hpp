@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <experimental/filesystem>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "item.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm::core {
+
+    /*
+     * A persistent catalog of every item any plugin has ever fed, matched or not.
+     *
+     * Items are appended to `<path>/items` in their serialized form. A trigram index over the
+     * normalized title, authors and series of each item is kept in `<path>/index`, which is
+     * memory-mapped and searched in place; trigrams of items added during this run are held in
+     * memory and merged into a new index file when the catalog is closed.
+     *
+     * Only one process may add to the catalog at a time; any other opens it read-only.
+     */
+    class catalog {
+    public:
+        /* Opens (or creates) the catalog in the given directory. Throws std::runtime_error on failure. */
+        explicit catalog(const fs::path &path);
+        explicit catalog(const catalog &) = delete;
+        ~catalog();
+
+        /* Add an item to the catalog, unless an equal one is already in it. Thread-safe. */
+        void add(const item &item);
+
+        /*
+         * Find cataloged items that may match the wanted item, and return those that actually do.
+         * Candidates are those that share enough trigrams with what's wanted.
+         */
+        vector<item> find(const item &wanted, const unsigned int fuzzy_min) const;
+
+        /* Flush added items and write the index. Any later add() is ignored. */
+        void close();
+
+        /* How many items are in the catalog? */
+        size_t size() const;
+
+    private:
+        using trigram = uint32_t;
+        using record_id = uint32_t;
+
+        /* Read what's on disk, rebuilding the index if it is out of date. */
+        void open_items();
+        void open_index();
+        void rebuild_index();
+
+        /* Index an item that is stored as the given record. */
+        void index_item(const item &item, record_id id);
+
+        /* Every record that contains the trigram, in ascending order. */
+        vector<record_id> postings(trigram tri) const;
+
+        void flush();
+        void write_index();
+
+        const fs::path path_;
+        int items_fd_ = -1;
+        bool writable_ = false, closed_ = false;
+
+        /* The item records present when the catalog was opened. */
+        const char *items_map_ = nullptr;
+        size_t items_map_size_ = 0;
+        vector<std::pair<uint64_t, uint32_t>> records_; // offset, length
+
+        /* The index present when the catalog was opened; see catalog.cpp for its layout. */
+        const char *index_map_ = nullptr;
+        size_t index_map_size_ = 0;
+        size_t indexed_trigrams_ = 0;
+
+        /*
+         * Trigrams and hashes of the records not covered by the index file: those added since
+         * the catalog was opened, or all of them if the index had to be rebuilt.
+         */
+        std::unordered_map<trigram, vector<record_id>> delta_;
+        vector<uint64_t> delta_hashes_;
+        bool index_stale_ = false;
+
+        /* Hashes of all cataloged items, used to ignore duplicates. */
+        std::unordered_set<size_t> hashes_;
+        size_t count_ = 0;
+
+        /* Records not yet written to disk. */
+        string pending_;
+        uint64_t items_size_ = 0;
+
+        mutable std::mutex mutex_;
+    };
+
+} // namespace bookwyrm::core
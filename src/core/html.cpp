@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <optional>
+
+#include "html.hpp"
+
+namespace bookwyrm::core::html {
+
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f'; }
+
+    static string lowercase(std::string_view str)
+    {
+        string lower(str);
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+        return lower;
+    }
+
+    static void append_utf8(string &str, uint32_t cp)
+    {
+        /* Not a character; the replacement character instead. */
+        if (cp == 0 || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+            cp = 0xfffd;
+
+        if (cp < 0x80) {
+            str += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            str += static_cast<char>(0xc0 | cp >> 6);
+            str += static_cast<char>(0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            str += static_cast<char>(0xe0 | cp >> 12);
+            str += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+            str += static_cast<char>(0x80 | (cp & 0x3f));
+        } else {
+            str += static_cast<char>(0xf0 | cp >> 18);
+            str += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+            str += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+            str += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    /* The code point of a character reference, without its '&' and ';', if it is one we know of. */
+    static std::optional<uint32_t> reference(std::string_view ref)
+    {
+        if (!ref.empty() && ref[0] == '#') {
+            const bool hex = ref.size() > 1 && (ref[1] == 'x' || ref[1] == 'X');
+            const auto digits = ref.substr(hex ? 2 : 1);
+            if (digits.empty() || digits.size() > 8)
+                return std::nullopt;
+
+            uint32_t cp = 0;
+            for (const char c : digits) {
+                if (hex ? !std::isxdigit(static_cast<unsigned char>(c)) : !std::isdigit(static_cast<unsigned char>(c)))
+                    return std::nullopt;
+                cp = cp * (hex ? 16 : 10) + (std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+            }
+            return cp;
+        }
+
+        // clang-format off
+        static const std::pair<std::string_view, uint32_t> named[] = {
+            {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''},
+            {"nbsp", 0xa0}, {"shy", 0xad}, {"copy", 0xa9}, {"reg", 0xae}, {"middot", 0xb7},
+            {"laquo", 0xab}, {"raquo", 0xbb}, {"ndash", 0x2013}, {"mdash", 0x2014}, {"hellip", 0x2026},
+        };
+        // clang-format on
+        for (const auto & [ name, cp ] : named) {
+            if (ref == name)
+                return cp;
+        }
+
+        return std::nullopt;
+    }
+
+    static void append_decoded(string &str, std::string_view raw)
+    {
+        while (!raw.empty()) {
+            const size_t amp = raw.find('&');
+            str.append(raw.substr(0, amp));
+            if (amp == std::string_view::npos)
+                return;
+            raw.remove_prefix(amp);
+
+            /* Anything that isn't a reference we know of is left as is. */
+            const size_t semicolon = raw.find(';');
+            const auto cp = semicolon != std::string_view::npos && semicolon <= 12 ? reference(raw.substr(1, semicolon - 1))
+                                                                                   : std::nullopt;
+            if (cp) {
+                append_utf8(str, *cp);
+                raw.remove_prefix(semicolon + 1);
+            } else {
+                str += '&';
+                raw.remove_prefix(1);
+            }
+        }
+    }
+
+    static bool matches(const attributes &attrs, const attributes &wanted)
+    {
+        return std::all_of(wanted.cbegin(), wanted.cend(), [&attrs](const auto &w) {
+            return std::any_of(attrs.cbegin(), attrs.cend(), [&w](const auto &a) {
+                if (a.first != w.first)
+                    return false;
+                if (a.first != "class")
+                    return a.second == w.second;
+
+                /* One of the classes, separated by whitespace. */
+                for (size_t pos = 0; pos < a.second.size();) {
+                    const size_t end = std::min(a.second.find_first_of(" \t\n\r\f", pos), a.second.size());
+                    if (a.second.compare(pos, end - pos, w.second) == 0)
+                        return true;
+                    pos = end + 1;
+                }
+                return false;
+            });
+        });
+    }
+
+    class extractor {
+    public:
+        explicit extractor(std::string_view document) : doc_(document) {}
+
+        vector<table> extract()
+        {
+            size_t pos = 0;
+            while (pos < doc_.size()) {
+                const size_t lt = doc_.find('<', pos);
+                text(doc_.substr(pos, lt == std::string_view::npos ? lt : lt - pos));
+                if (lt == std::string_view::npos)
+                    break;
+
+                pos = tag(lt);
+            }
+
+            return std::move(tables_);
+        }
+
+    private:
+        /* Where we are in one of the open tables. */
+        struct frame {
+            size_t table;
+            bool in_cell = false;
+
+            /* The index of the open link in the cell, if any. */
+            std::optional<size_t> link;
+        };
+
+        /* Parse the tag (or comment, or declaration) at pos; returns where it ends. */
+        size_t tag(size_t pos)
+        {
+            const auto rest = doc_.substr(pos);
+            const auto skip_to = [this](size_t from, std::string_view end) {
+                const size_t found = doc_.find(end, from);
+                return found == std::string_view::npos ? doc_.size() : found + end.size();
+            };
+
+            if (rest.substr(0, 4) == "<!--")
+                return skip_to(pos + 4, "-->");
+            if (rest.size() > 1 && (rest[1] == '!' || rest[1] == '?'))
+                return skip_to(pos, ">");
+
+            size_t i = pos + 1;
+            const bool closing = i < doc_.size() && doc_[i] == '/';
+            if (closing)
+                i++;
+
+            const size_t name_start = i;
+            while (i < doc_.size() && (std::isalnum(static_cast<unsigned char>(doc_[i])) || doc_[i] == '-' || doc_[i] == ':'))
+                i++;
+            if (i == name_start) {
+                /* A lone '<' is text. */
+                text(doc_.substr(pos, 1));
+                return pos + 1;
+            }
+            const string name = lowercase(doc_.substr(name_start, i - name_start));
+
+            attributes attrs;
+            while (i < doc_.size()) {
+                while (i < doc_.size() && (is_space(doc_[i]) || doc_[i] == '/'))
+                    i++;
+                if (i == doc_.size())
+                    break;
+                if (doc_[i] == '>') {
+                    i++;
+                    break;
+                }
+
+                const size_t attr_start = i;
+                while (i < doc_.size() && !is_space(doc_[i]) && doc_[i] != '=' && doc_[i] != '>' && doc_[i] != '/')
+                    i++;
+                if (i == attr_start) {
+                    /* A stray '='. */
+                    i++;
+                    continue;
+                }
+                const auto attr = doc_.substr(attr_start, i - attr_start);
+
+                while (i < doc_.size() && is_space(doc_[i]))
+                    i++;
+                std::string_view value;
+                if (i < doc_.size() && doc_[i] == '=') {
+                    i++;
+                    while (i < doc_.size() && is_space(doc_[i]))
+                        i++;
+
+                    if (i < doc_.size() && (doc_[i] == '"' || doc_[i] == '\'')) {
+                        const size_t end = std::min(doc_.find(doc_[i], i + 1), doc_.size());
+                        value = doc_.substr(i + 1, end - i - 1);
+                        i = std::min(end + 1, doc_.size());
+                    } else {
+                        const size_t value_start = i;
+                        while (i < doc_.size() && !is_space(doc_[i]) && doc_[i] != '>')
+                            i++;
+                        value = doc_.substr(value_start, i - value_start);
+                    }
+                }
+
+                if (!closing) {
+                    string decoded;
+                    append_decoded(decoded, value);
+                    attrs.emplace_back(lowercase(attr), std::move(decoded));
+                }
+            }
+
+            if (closing) {
+                end_tag(name);
+                return i;
+            }
+            start_tag(name, std::move(attrs));
+
+            /* The contents of these are not markup, nor text anyone wants. */
+            if (name == "script" || name == "style") {
+                for (size_t end = doc_.find("</", i); end != std::string_view::npos; end = doc_.find("</", end + 2)) {
+                    if (lowercase(doc_.substr(end + 2, name.size())) == name)
+                        return end;
+                }
+                return doc_.size();
+            }
+
+            return i;
+        }
+
+        void start_tag(const string &name, attributes attrs)
+        {
+            if (name == "table") {
+                tables_.push_back({std::move(attrs), {}});
+                stack_.push_back({tables_.size() - 1, false, std::nullopt});
+                return;
+            }
+            if (stack_.empty())
+                return;
+
+            auto &f = stack_.back();
+            auto &rows = tables_[f.table].rows;
+            if (name == "tr") {
+                rows.emplace_back();
+                f.in_cell = false;
+                f.link.reset();
+            } else if (name == "td" || name == "th") {
+                /* A cell outside of a row starts one. */
+                if (rows.empty())
+                    rows.emplace_back();
+                rows.back().emplace_back();
+                f.in_cell = true;
+                f.link.reset();
+            } else if (name == "a" && f.in_cell) {
+                auto &links = rows.back().back().links;
+                links.push_back({std::move(attrs), {}});
+                f.link = links.size() - 1;
+            }
+        }
+
+        void end_tag(const string &name)
+        {
+            if (stack_.empty())
+                return;
+
+            auto &f = stack_.back();
+            if (name == "table") {
+                stack_.pop_back();
+            } else if (name == "tr" || name == "td" || name == "th") {
+                f.in_cell = false;
+                f.link.reset();
+            } else if (name == "a") {
+                f.link.reset();
+            }
+        }
+
+        void text(std::string_view raw)
+        {
+            if (raw.empty() || stack_.empty() || !stack_.back().in_cell)
+                return;
+
+            const auto &f = stack_.back();
+            auto &c = tables_[f.table].rows.back().back();
+
+            string decoded;
+            append_decoded(decoded, raw);
+            if (f.link && !std::all_of(decoded.cbegin(), decoded.cend(), is_space))
+                c.links[*f.link].fragments.push_back(decoded);
+            c.text += decoded;
+        }
+
+        const std::string_view doc_;
+        vector<table> tables_;
+        vector<frame> stack_;
+    };
+
+    vector<table> tables(std::string_view document, const attributes &wanted)
+    {
+        auto all = extractor(document).extract();
+        if (wanted.empty())
+            return all;
+
+        vector<table> matching;
+        for (auto &t : all) {
+            if (matches(t.attrs, wanted))
+                matching.push_back(std::move(t));
+        }
+
+        return matching;
+    }
+
+} // namespace bookwyrm::core::html
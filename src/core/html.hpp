@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string_view>
+
+#include "item.hpp"
+
+/*
+ * Extracts the tables of an HTML document in one pass, for plugins that scrape search results,
+ * without building a tree of the whole document. Like browsers, it is forgiving: unclosed cells
+ * and rows are closed by the next one, and stray end tags are ignored. Character references
+ * are decoded; &nbsp; becomes U+00A0, as Python's html.parser has it.
+ */
+
+namespace bookwyrm::core::html {
+
+    using attributes = vector<std::pair<string, string>>;
+
+    /* An <a> in a cell. */
+    struct link {
+        attributes attrs;
+
+        /* Each run of text in the link between two tags, leaving out those that are only whitespace. */
+        vector<string> fragments;
+    };
+
+    struct cell {
+        /* All text in the cell, as is, except for that of any table nested in it. */
+        string text;
+        vector<link> links;
+    };
+
+    struct table {
+        attributes attrs;
+        vector<vector<cell>> rows;
+    };
+
+    /*
+     * The tables of the document, in the order they start, nested ones included, with all
+     * attributes in wanted. A class is matched if it is one of the element's classes.
+     */
+    vector<table> tables(std::string_view document, const attributes &wanted = {});
+
+} // namespace bookwyrm::core::html
@@ -0,0 +1,340 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <fmt/format.h>
+#include <zlib.h>
+
+#include "http_cache.hpp"
+
+namespace bookwyrm::core {
+
+    /*
+     * Entry layout (host byte order; strings are a uint32_t length followed by that many bytes):
+     *   magic      4 bytes, "bwhc"
+     *   version    uint32_t, bumped whenever the layout changes
+     *   validated  int64_t, seconds since the epoch when last received or revalidated
+     *   max_age    int64_t, seconds it is fresh for after that, or -1 if the server didn't say
+     *   status     int64_t
+     *   key, url   strings
+     *   headers    uint32_t count, followed by as many pairs of strings
+     *   body       uint64_t length, uint64_t compressed length, followed by the zlib stream
+     */
+    constexpr char magic[4] = {'b', 'w', 'h', 'c'};
+    constexpr uint32_t version = 1;
+
+    using clock = std::chrono::system_clock;
+
+    template <typename T> static void put(string &buf, T value)
+    {
+        buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static void put(string &buf, const string &str)
+    {
+        put(buf, static_cast<uint32_t>(str.size()));
+        buf.append(str);
+    }
+
+    template <typename T> static T get(std::string_view &data)
+    {
+        if (data.size() < sizeof(T))
+            throw std::runtime_error("truncated cache entry");
+
+        T value;
+        std::memcpy(&value, data.data(), sizeof(T));
+        data.remove_prefix(sizeof(T));
+        return value;
+    }
+
+    static string get_string(std::string_view &data)
+    {
+        const auto len = get<uint32_t>(data);
+        if (data.size() < len)
+            throw std::runtime_error("truncated cache entry");
+
+        string str(data.substr(0, len));
+        data.remove_prefix(len);
+        return str;
+    }
+
+    static int64_t seconds_since_epoch(clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(t.time_since_epoch()).count();
+    }
+
+    static const string *header(const http_response &response, const string &name)
+    {
+        const auto it = std::find_if(response.headers.cbegin(), response.headers.cend(),
+                                     [&name](const auto &h) { return h.first == name; });
+        return it != response.headers.cend() ? &it->second : nullptr;
+    }
+
+    /* For how long the response may be served without asking; -1 if the server didn't say, or nothing if it may not be stored. */
+    static std::optional<int64_t> max_age(const http_response &response)
+    {
+        if (const auto *vary = header(response, "vary"); vary && vary->find('*') != string::npos)
+            return std::nullopt;
+
+        const auto *cache_control = header(response, "cache-control");
+        if (!cache_control)
+            return -1;
+
+        string directives = *cache_control;
+        std::transform(directives.begin(), directives.end(), directives.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        int64_t age = -1;
+        for (size_t pos = 0; pos < directives.size();) {
+            const size_t end = std::min(directives.find(',', pos), directives.size());
+            auto directive = std::string_view(directives).substr(pos, end - pos);
+            pos = end + 1;
+
+            while (!directive.empty() && std::isspace(static_cast<unsigned char>(directive.front())))
+                directive.remove_prefix(1);
+            while (!directive.empty() && std::isspace(static_cast<unsigned char>(directive.back())))
+                directive.remove_suffix(1);
+
+            if (directive == "no-store")
+                return std::nullopt;
+            if (directive == "no-cache") {
+                age = 0;
+            } else if (directive.substr(0, 8) == "max-age=" && age != 0) {
+                try {
+                    age = std::max<int64_t>(0, std::stoll(string(directive.substr(8))));
+                } catch (const std::logic_error &) {
+                    age = 0;
+                }
+            }
+        }
+
+        return age;
+    }
+
+    http_cache::http_cache(const fs::path &dir, uintmax_t max_size, bool revalidate, std::chrono::seconds fresh_for)
+        : dir_(dir), max_size_(max_size), revalidate_(revalidate), fresh_for_(fresh_for)
+    {
+        std::error_code ec;
+        fs::create_directories(dir_, ec);
+
+        for (fs::directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+            const auto &path = it->path();
+            if (path.extension() != ".http")
+                continue;
+
+            size_t hash;
+            try {
+                hash = std::stoull(path.stem().string(), nullptr, 16);
+            } catch (const std::logic_error &) {
+                continue;
+            }
+
+            std::error_code size_ec, time_ec;
+            const auto size = fs::file_size(path, size_ec);
+            const auto last_used = fs::last_write_time(path, time_ec);
+            if (size_ec || time_ec)
+                continue;
+
+            entries_[hash] = {size, last_used};
+            total_size_ += size;
+        }
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        evict();
+    }
+
+    fs::path http_cache::path_of(size_t hash) const { return dir_ / fmt::format("{:016x}.http", hash); }
+
+    std::optional<http_cache::entry> http_cache::load(const string &key)
+    {
+        const auto hash = std::hash<string>()(key);
+        const auto path = path_of(hash);
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return std::nullopt;
+
+        const string contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        std::string_view data = contents;
+
+        entry e;
+        try {
+            if (data.size() < sizeof(magic) || std::memcmp(data.data(), magic, sizeof(magic)) != 0)
+                return std::nullopt;
+            data.remove_prefix(sizeof(magic));
+
+            if (get<uint32_t>(data) != version)
+                return std::nullopt;
+
+            const clock::time_point validated{std::chrono::seconds(get<int64_t>(data))};
+            const auto lifetime = get<int64_t>(data);
+            e.response.status = get<int64_t>(data);
+
+            /* A hash collision. */
+            if (get_string(data) != key)
+                return std::nullopt;
+            e.response.url = get_string(data);
+
+            for (auto count = get<uint32_t>(data); count > 0; count--) {
+                auto name = get_string(data);
+                e.response.headers.emplace_back(std::move(name), get_string(data));
+            }
+
+            const auto age = clock::now() - validated;
+            e.fresh = !revalidate_ && (lifetime >= 0 ? age < std::chrono::seconds(lifetime) : age < fresh_for_);
+
+            /* A stale response that can't be revalidated is of no use. */
+            if (!e.fresh && conditions(e.response).empty())
+                return std::nullopt;
+
+            const auto length = get<uint64_t>(data);
+            const auto compressed = get<uint64_t>(data);
+            if (data.size() != compressed)
+                throw std::runtime_error("truncated cache entry");
+
+            /* zlib compresses by at most 1032:1. */
+            if (length > compressed * 1032)
+                throw std::runtime_error("corrupt cache entry");
+
+            e.response.body.resize(length);
+            uLongf body_length = length;
+            if (uncompress(reinterpret_cast<Bytef *>(e.response.body.data()), &body_length,
+                           reinterpret_cast<const Bytef *>(data.data()), compressed) != Z_OK ||
+                body_length != length)
+                throw std::runtime_error("corrupt cache entry");
+        } catch (const std::runtime_error &) {
+            /* A corrupt entry is as good as a missing one; it will be overwritten. */
+            return std::nullopt;
+        }
+        e.response.cached = true;
+
+        /* The modification time records the last use, for the next run's sake. */
+        std::error_code ec;
+        const auto now = fs::file_time_type::clock::now();
+        fs::last_write_time(path, now, ec);
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto &u = entries_[hash];
+        total_size_ = total_size_ - u.size + contents.size();
+        u = {contents.size(), now};
+
+        return e;
+    }
+
+    void http_cache::store(const string &key, const http_response &response)
+    {
+        if (response.status != 200)
+            return;
+        const auto age = max_age(response);
+        if (!age)
+            return;
+
+        string buf(magic, sizeof(magic));
+        put(buf, version);
+        put(buf, static_cast<int64_t>(seconds_since_epoch(clock::now())));
+        put(buf, *age);
+        put(buf, static_cast<int64_t>(response.status));
+        put(buf, key);
+        put(buf, response.url);
+
+        put(buf, static_cast<uint32_t>(response.headers.size()));
+        for (const auto & [ name, value ] : response.headers) {
+            put(buf, name);
+            put(buf, value);
+        }
+
+        const auto header_size = buf.size();
+        uLongf compressed = compressBound(response.body.size());
+        buf.resize(header_size + 2 * sizeof(uint64_t) + compressed);
+        if (compress2(reinterpret_cast<Bytef *>(buf.data() + header_size + 2 * sizeof(uint64_t)), &compressed,
+                      reinterpret_cast<const Bytef *>(response.body.data()), response.body.size(),
+                      Z_DEFAULT_COMPRESSION) != Z_OK)
+            return;
+        buf.resize(header_size + 2 * sizeof(uint64_t) + compressed);
+
+        const uint64_t lengths[2] = {response.body.size(), compressed};
+        std::memcpy(buf.data() + header_size, lengths, sizeof(lengths));
+
+        /* An entry that would push out everything else isn't worth it. */
+        if (buf.size() > max_size_)
+            return;
+
+        /* Write to a temporary file first, so that a concurrent load() never sees half an entry. */
+        const auto hash = std::hash<string>()(key);
+        const auto path = path_of(hash), tmp = fs::path(path).concat(".tmp");
+
+        std::error_code ec;
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(buf.data(), buf.size());
+        file.close();
+
+        /* A cache that can't be written is no worse than none. */
+        if (!file) {
+            fs::remove(tmp, ec);
+            return;
+        }
+        fs::rename(tmp, path, ec);
+        if (ec)
+            return;
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto &u = entries_[hash];
+        total_size_ = total_size_ - u.size + buf.size();
+        u = {buf.size(), fs::file_time_type::clock::now()};
+
+        evict();
+    }
+
+    http_response http_cache::refresh(const string &key, http_response cached, const http_response &not_modified)
+    {
+        for (const auto & [ name, value ] : not_modified.headers) {
+            /* The length is that of the cached body, not that of the empty 304. */
+            if (name == "content-length")
+                continue;
+
+            auto &headers = cached.headers;
+            headers.erase(std::remove_if(headers.begin(), headers.end(), [&name](const auto &h) { return h.first == name; }),
+                          headers.end());
+            headers.emplace_back(name, value);
+        }
+
+        store(key, cached);
+        cached.cached = true;
+        return cached;
+    }
+
+    vector<string> http_cache::conditions(const http_response &cached)
+    {
+        vector<string> conditions;
+        if (const auto *etag = header(cached, "etag"))
+            conditions.push_back("If-None-Match: " + *etag);
+        if (const auto *last_modified = header(cached, "last-modified"))
+            conditions.push_back("If-Modified-Since: " + *last_modified);
+
+        return conditions;
+    }
+
+    void http_cache::evict()
+    {
+        if (total_size_ <= max_size_)
+            return;
+
+        vector<std::pair<fs::file_time_type, size_t>> by_use;
+        for (const auto & [ hash, u ] : entries_)
+            by_use.emplace_back(u.last_used, hash);
+        std::sort(by_use.begin(), by_use.end());
+
+        std::error_code ec;
+        for (const auto & [ last_used, hash ] : by_use) {
+            if (total_size_ <= max_size_)
+                break;
+
+            fs::remove(path_of(hash), ec);
+            total_size_ -= entries_[hash].size;
+            entries_.erase(hash);
+        }
+    }
+
+} // namespace bookwyrm::core
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <experimental/filesystem>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "http_client.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm::core {
+
+    /*
+     * An on-disk cache of the pages plugins fetch, shared by all runs of bookwyrm.
+     *
+     * Each response is a single file in the cache directory, named after the hash of its key
+     * (the URL and the request headers), holding its headers and its body, compressed. Responses
+     * are served as they are for as long as their Cache-Control max-age says, or fresh_for if it
+     * says nothing. After that, those with an ETag or Last-Modified are revalidated with a
+     * conditional request, and the rest are fetched anew. Once the entries take up more than
+     * max_size, the least recently used are removed. If revalidate is set, no response is
+     * fresh, as when search results are refreshed.
+     */
+    class http_cache {
+    public:
+        http_cache(const fs::path &dir,
+                   uintmax_t max_size,
+                   bool revalidate = false,
+                   std::chrono::seconds fresh_for = std::chrono::hours(1));
+
+        struct entry {
+            http_response response;
+
+            /* May it be served without asking the server? */
+            bool fresh;
+        };
+
+        /* The response cached under the key, if any. */
+        std::optional<entry> load(const string &key);
+
+        /* Cache a successful response under the key, unless its Cache-Control or Vary forbid it. */
+        void store(const string &key, const http_response &response);
+
+        /*
+         * The server says the cached response has not changed (HTTP 304). Returns the cached
+         * response with the headers of the 304 response, and caches it anew.
+         */
+        http_response refresh(const string &key, http_response cached, const http_response &not_modified);
+
+        /* The headers ("Name: value") that ask the server to only send the response if it has changed. */
+        static vector<string> conditions(const http_response &cached);
+
+        const fs::path &dir() const { return dir_; }
+        uintmax_t max_size() const { return max_size_; }
+        bool revalidates() const { return revalidate_; }
+
+    private:
+        struct usage {
+            uintmax_t size;
+            fs::file_time_type last_used;
+        };
+
+        fs::path path_of(size_t hash) const;
+
+        /* Remove the least recently used entries until they fit in max_size_. Requires mutex_. */
+        void evict();
+
+        const fs::path dir_;
+        const uintmax_t max_size_;
+        const bool revalidate_;
+        const std::chrono::seconds fresh_for_;
+
+        /* Guards everything below. */
+        std::mutex mutex_;
+
+        /* Of each entry, by the hash of its key. */
+        std::unordered_map<size_t, usage> entries_;
+        uintmax_t total_size_ = 0;
+    };
+
+} // namespace bookwyrm::core
@@ -0,0 +1,282 @@
+#include <algorithm>
+#include <cctype>
+
+#include <fmt/format.h>
+
+#include "http_cache.hpp"
+#include "http_client.hpp"
+#include "http_share.hpp"
+
+namespace bookwyrm::core {
+
+    /* The host of a URL, for spacing out the requests to it. */
+    static string host_of(const string &url)
+    {
+        const auto scheme = url.find("://");
+        const auto start = scheme == string::npos ? 0 : scheme + 3;
+        const auto end = url.find_first_of(":/?#", start);
+
+        return url.substr(start, end == string::npos ? string::npos : end - start);
+    }
+
+    http_client::http_client(http_options options) : options_(options)
+    {
+        curl_global_init(CURL_GLOBAL_ALL);
+        multi_ = curl_multi_init();
+        if (!multi_)
+            throw std::runtime_error("curl could not initialize");
+
+        /* Requests over the limits are queued by curl until a connection is free. */
+        curl_multi_setopt(multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(options_.max_transfers));
+        curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(options_.max_per_host));
+        curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+        thread_ = std::thread(&http_client::run, this);
+    }
+
+    http_client::~http_client()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        curl_multi_wakeup(multi_);
+        thread_.join();
+
+        const auto cancelled = [](request &req) {
+            req.promise.set_exception(std::make_exception_ptr(http_error(req.url + ": the request was cancelled")));
+        };
+        for (auto &req : running_) {
+            curl_multi_remove_handle(multi_, req->curl);
+            curl_easy_cleanup(req->curl);
+            curl_slist_free_all(req->header_list);
+            cancelled(*req);
+        }
+        for (auto &req : queued_)
+            cancelled(*req);
+
+        for (CURL *curl : idle_)
+            curl_easy_cleanup(curl);
+        curl_multi_cleanup(multi_);
+        curl_global_cleanup();
+    }
+
+    http_client::result http_client::fetch(const string &url, const vector<string> &headers)
+    {
+        string key = url;
+        for (const auto &h : headers)
+            key += '\n' + h;
+
+        std::shared_ptr<http_cache> cache;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if (const auto it = in_flight_.find(key); it != in_flight_.end())
+                return it->second;
+            cache = cache_;
+        }
+
+        auto req = std::make_unique<request>();
+        req->key = key;
+        req->url = url;
+        req->host = host_of(url);
+        req->headers = headers;
+        req->cache = cache;
+        if (auto cached = cache ? cache->load(key) : std::nullopt; cached && cached->fresh) {
+            req->promise.set_value(std::move(cached->response));
+            return req->promise.get_future().share();
+        } else if (cached) {
+            /* Only sent whole if it has changed since. */
+            for (auto &condition : http_cache::conditions(cached->response))
+                req->headers.push_back(std::move(condition));
+            req->cached = std::move(cached->response);
+        }
+
+        result res = req->promise.get_future().share();
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            /* The same request may have been made while the cache was read. */
+            if (const auto it = in_flight_.find(key); it != in_flight_.end())
+                return it->second;
+
+            in_flight_.emplace(std::move(key), res);
+            queued_.push_back(std::move(req));
+        }
+        curl_multi_wakeup(multi_);
+
+        return res;
+    }
+
+    void http_client::cache_to(const fs::path &dir, uintmax_t max_size, bool revalidate)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (cache_ && cache_->dir() == dir && cache_->max_size() == max_size && cache_->revalidates() == revalidate)
+            return;
+
+        cache_ = std::make_shared<http_cache>(dir, max_size, revalidate);
+    }
+
+    void http_client::share_with(std::shared_ptr<http_share> share)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        share_ = std::move(share);
+    }
+
+    std::chrono::milliseconds http_client::start_queued()
+    {
+        using namespace std::chrono;
+
+        const auto now = steady_clock::now();
+        auto wait = milliseconds(1000);
+
+        std::lock_guard<std::mutex> guard(mutex_);
+        for (auto it = queued_.begin(); it != queued_.end();) {
+            auto &next = next_start_[(*it)->host];
+            if (next > now) {
+                wait = std::min(wait, duration_cast<milliseconds>(next - now) + milliseconds(1));
+                ++it;
+                continue;
+            }
+            next = now + options_.host_interval;
+
+            auto req = std::move(*it);
+            it = queued_.erase(it);
+
+            CURL *curl;
+            if (!idle_.empty()) {
+                curl = idle_.back();
+                idle_.pop_back();
+                curl_easy_reset(curl);
+            } else if (curl = curl_easy_init(); !curl) {
+                in_flight_.erase(req->key);
+                req->promise.set_exception(std::make_exception_ptr(http_error("curl could not initialize")));
+                continue;
+            }
+            req->curl = curl;
+
+            curl_easy_setopt(curl, CURLOPT_URL, req->url.c_str());
+            curl_easy_setopt(curl, CURLOPT_PRIVATE, req.get());
+            curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 10L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, options_.user_agent.c_str());
+            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, static_cast<long>(options_.timeout.count()));
+
+            /* Whatever compression curl supports is accepted. */
+            curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+            if (share_)
+                share_->apply(curl);
+
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, http_client::write_callback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, req.get());
+            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, http_client::header_callback);
+            curl_easy_setopt(curl, CURLOPT_HEADERDATA, req.get());
+
+            for (const auto &h : req->headers)
+                req->header_list = curl_slist_append(req->header_list, h.c_str());
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req->header_list);
+
+            curl_multi_add_handle(multi_, curl);
+            running_.push_back(std::move(req));
+        }
+
+        return wait;
+    }
+
+    void http_client::finish(request &req, CURLcode result)
+    {
+        curl_multi_remove_handle(multi_, req.curl);
+        if (result == CURLE_OK) {
+            char *url = nullptr;
+            curl_easy_getinfo(req.curl, CURLINFO_RESPONSE_CODE, &req.response.status);
+            curl_easy_getinfo(req.curl, CURLINFO_EFFECTIVE_URL, &url);
+            req.response.url = url != nullptr ? url : req.url;
+
+            if (req.cached && req.response.status == 304)
+                req.response = req.cache->refresh(req.key, std::move(*req.cached), req.response);
+            else if (req.cache)
+                req.cache->store(req.key, req.response);
+        }
+        curl_slist_free_all(req.header_list);
+        idle_.push_back(req.curl);
+
+        /* Later requests for the same page are sent anew. */
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            in_flight_.erase(req.key);
+        }
+
+        if (result == CURLE_OK)
+            req.promise.set_value(std::move(req.response));
+        else
+            req.promise.set_exception(
+                std::make_exception_ptr(http_error(fmt::format("{}: {}", req.url, curl_easy_strerror(result)))));
+
+        running_.erase(std::find_if(running_.begin(), running_.end(), [&req](const auto &r) { return r.get() == &req; }));
+    }
+
+    void http_client::run()
+    {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                if (stop_)
+                    return;
+            }
+
+            const auto wait = start_queued();
+
+            int running;
+            curl_multi_perform(multi_, &running);
+
+            int left;
+            while (CURLMsg *msg = curl_multi_info_read(multi_, &left)) {
+                if (msg->msg != CURLMSG_DONE)
+                    continue;
+
+                request *req;
+                curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &req);
+                finish(*req, msg->data.result);
+            }
+
+            /* Until something happens, a new request comes in, or the next may be sent to a host. */
+            curl_multi_poll(multi_, nullptr, 0, static_cast<int>(wait.count()), nullptr);
+        }
+    }
+
+    size_t http_client::write_callback(char *data, size_t size, size_t nmemb, void *userdata)
+    {
+        static_cast<request *>(userdata)->response.body.append(data, size * nmemb);
+        return size * nmemb;
+    }
+
+    size_t http_client::header_callback(char *data, size_t size, size_t nmemb, void *userdata)
+    {
+        auto *req = static_cast<request *>(userdata);
+        const size_t length = size * nmemb;
+
+        std::string_view line(data, length);
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+            line.remove_suffix(1);
+
+        /* Each response, of a redirect or not, starts with its status line. */
+        if (line.substr(0, 5) == "HTTP/") {
+            req->response.headers.clear();
+            return length;
+        }
+
+        if (const auto colon = line.find(':'); colon != std::string_view::npos) {
+            string name(line.substr(0, colon));
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+
+            auto value = line.substr(colon + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+                value.remove_prefix(1);
+            req->response.headers.emplace_back(std::move(name), string(value));
+        }
+
+        return length;
+    }
+
+} // namespace bookwyrm::core
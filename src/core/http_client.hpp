@@ -0,0 +1,143 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <curl/curl.h>
+#include <deque>
+#include <experimental/filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "item.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm::core {
+
+    class http_cache;
+    class http_share;
+
+    /* A request that failed before any response was received. */
+    class http_error : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    struct http_response {
+        long status = 0;
+
+        /* Where the request ended up, after any redirects. */
+        string url;
+
+        /* Of the last response, in the order received; names are lowercase. */
+        vector<std::pair<string, string>> headers;
+
+        /* Decompressed, if the server compressed it. */
+        string body;
+
+        /* Was it served from the cache, whether or not the server was asked if it had changed? */
+        bool cached = false;
+    };
+
+    struct http_options {
+        /* How many requests to run at once, in total and per host. */
+        size_t max_transfers = 16;
+        size_t max_per_host = 4;
+
+        /* The least time between the starts of two requests to the same host. */
+        std::chrono::milliseconds host_interval{250};
+
+        /* How long a request may take in all. */
+        std::chrono::seconds timeout{60};
+
+        string user_agent = "Mozilla/5.0 (X11; Linux x86_64; rv:63.0) Gecko/20100101 Firefox/63.0";
+    };
+
+    /*
+     * Fetches pages for plugins on a thread of its own, over one libcurl multi handle, so that
+     * connections are reused across requests and plugins, and many pages may be fetched at once.
+     * Responses are decompressed as the server sends them. Identical requests made while one is
+     * already running are given the response of that one instead of being sent again, and, once
+     * cache_to() is called, those made before are answered from the cache where it may.
+     */
+    class http_client {
+    public:
+        using result = std::shared_future<http_response>;
+
+        explicit http_client(http_options options = {});
+
+        /* Requests that are still running fail with http_error. */
+        ~http_client();
+
+        /*
+         * Start fetching the URL, with the given headers ("Name: value"), and return at once.
+         * The result throws http_error if no response was received.
+         */
+        result fetch(const string &url, const vector<string> &headers = {});
+
+        /* Fetch the URL and wait for the response. */
+        http_response get(const string &url, const vector<string> &headers = {}) { return fetch(url, headers).get(); }
+
+        /*
+         * Cache responses in dir from now on, keeping at most max_size bytes there; see http_cache.
+         * If revalidate is set, cached responses are only served once the server says they haven't changed.
+         */
+        void cache_to(const fs::path &dir, uintmax_t max_size, bool revalidate = false);
+
+        /* Look up hosts and resume TLS sessions through the share for requests started from now on. */
+        void share_with(std::shared_ptr<http_share> share);
+
+    private:
+        struct request {
+            string key, url, host;
+            vector<string> headers;
+            std::promise<http_response> promise;
+
+            /* Where to cache the response, if anywhere, and the stale response it may replace. */
+            std::shared_ptr<http_cache> cache;
+            std::optional<http_response> cached;
+
+            CURL *curl = nullptr;
+            struct curl_slist *header_list = nullptr;
+            http_response response;
+        };
+
+        static size_t write_callback(char *data, size_t size, size_t nmemb, void *userdata);
+        static size_t header_callback(char *data, size_t size, size_t nmemb, void *userdata);
+
+        /* Runs on thread_ until the client is destroyed. */
+        void run();
+
+        /* Start the queued requests whose hosts may be sent another. Returns how long until the next may be. */
+        std::chrono::milliseconds start_queued();
+
+        /* Hand the request its response, or the error. */
+        void finish(request &req, CURLcode result);
+
+        const http_options options_;
+        CURLM *multi_;
+
+        /* Only touched by thread_. */
+        std::unordered_map<string, std::chrono::steady_clock::time_point> next_start_;
+        vector<std::unique_ptr<request>> running_;
+        vector<CURL *> idle_;
+
+        /* Guards everything below. */
+        std::mutex mutex_;
+        std::deque<std::unique_ptr<request>> queued_;
+
+        /* Of the requests queued or running, by their key. */
+        std::map<string, result> in_flight_;
+        std::shared_ptr<http_cache> cache_;
+        std::shared_ptr<http_share> share_;
+        bool stop_ = false;
+
+        std::thread thread_;
+    };
+
+} // namespace bookwyrm::core
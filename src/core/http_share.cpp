@@ -0,0 +1,48 @@
+#include <stdexcept>
+
+#include "http_share.hpp"
+
+namespace bookwyrm::core {
+
+    http_share::http_share()
+    {
+        curl_global_init(CURL_GLOBAL_ALL);
+        share_ = curl_share_init();
+        if (!share_) {
+            curl_global_cleanup();
+            throw std::runtime_error("curl could not initialize");
+        }
+
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, http_share::lock);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, http_share::unlock);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    http_share::~http_share()
+    {
+        curl_share_cleanup(share_);
+        curl_global_cleanup();
+    }
+
+    void http_share::apply(CURL *curl) const
+    {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+
+        /* Multiplexed over a single connection when possible; plain HTTP stays HTTP/1.1. */
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    }
+
+    void http_share::lock(CURL *, curl_lock_data data, curl_lock_access, void *userptr)
+    {
+        static_cast<http_share *>(userptr)->locks_[data].lock();
+    }
+
+    void http_share::unlock(CURL *, curl_lock_data data, void *userptr)
+    {
+        static_cast<http_share *>(userptr)->locks_[data].unlock();
+    }
+
+} // namespace bookwyrm::core
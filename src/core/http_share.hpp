@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <curl/curl.h>
+#include <mutex>
+
+namespace bookwyrm::core {
+
+    /*
+     * The DNS and TLS session caches shared by every transfer bookwyrm makes, the downloader's
+     * and those of the pages plugins fetch, so that repeated requests to the same host skip the
+     * lookup and the full handshake. Connections aren't shared: the downloader and the plugins'
+     * client run their multi handles on threads of their own, and each pools its own connections.
+     * Handles may be used on any thread; must outlive every handle it was applied to.
+     */
+    class http_share {
+    public:
+        explicit http_share();
+        ~http_share();
+        http_share(const http_share &) = delete;
+        http_share &operator=(const http_share &) = delete;
+
+        /* Have the handle use the shared caches, and HTTP/2 where the host supports it. */
+        void apply(CURL *curl) const;
+
+    private:
+        static void lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr);
+        static void unlock(CURL *curl, curl_lock_data data, void *userptr);
+
+        CURLSH *share_;
+
+        /* One lock per kind of shared data. */
+        std::array<std::mutex, CURL_LOCK_DATA_LAST> locks_;
+    };
+
+} // namespace bookwyrm::core
@@ -171,4 +171,28 @@ namespace bookwyrm::core {
         return true;
     }
 
+    unsigned int item::score(const item &wanted) const
+    {
+        unsigned int score = 100;
+
+        const std::array<string, 3> in_result = {{this->nonexacts.title, this->nonexacts.series, this->nonexacts.publisher}},
+                                    requested = {
+                                        {wanted.nonexacts.title, wanted.nonexacts.series, wanted.nonexacts.publisher}};
+
+        for (const auto & [ req, got ] : func::zip(requested, in_result)) {
+            if (!req.empty())
+                score = std::min(score, fuzz::partial_ratio(got, req));
+        }
+
+        if (!wanted.nonexacts.authors.empty()) {
+            unsigned int max_ratio = 0;
+            for (const auto & [ req, got ] : algorithm::product(wanted.nonexacts.authors, this->nonexacts.authors))
+                max_ratio = std::max(fuzz::token_set_ratio(req, got), max_ratio);
+
+            score = std::min(score, max_ratio);
+        }
+
+        return score;
+    }
+
 } // namespace bookwyrm::core
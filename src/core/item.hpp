@@ -68,6 +68,11 @@ namespace bookwyrm::core {
         {
         }
 
+        explicit exacts_t(year_mod ymod, int year, int volume, int number, int pages, int size, const string &extension)
+            : ymod(ymod), year(year), volume(volume), number(number), pages(pages), size(size), extension(extension)
+        {
+        }
+
         explicit exacts_t(const py::dict &dict);
 
         exacts_t() : ymod(year_mod::unused), year(empty), volume(empty), number(empty), pages(empty), size(empty) {}
@@ -93,8 +98,9 @@ namespace bookwyrm::core {
                              const string &title,
                              const string &series,
                              const string &publisher,
-                             const string &journal)
-            : authors(authors), title(title), series(series), publisher(publisher), journal(journal)
+                             const string &journal,
+                             const string &edition = "")
+            : authors(authors), title(title), series(series), publisher(publisher), journal(journal), edition(edition)
         {
         }
 
@@ -123,6 +129,14 @@ namespace bookwyrm::core {
 
     struct misc_t {
         /* Holds everything else. */
+        explicit misc_t(const vector<string> &uris,
+                        const vector<string> &isbns,
+                        const vector<string> &mirrors,
+                        const string &origin_plugin)
+            : uris(uris), isbns(isbns), mirrors(mirrors), origin_plugin(origin_plugin)
+        {
+        }
+
         explicit misc_t(const py::dict &dict);
 
         misc_t() = default;
@@ -141,6 +155,18 @@ namespace bookwyrm::core {
 
         explicit item(const py::dict &dict) : nonexacts(dict), exacts(dict), misc(dict), index(items_idx++) {}
 
+        /* Restore a previously found item as if it was just found. */
+        explicit item(const nonexacts_t ne, const exacts_t e, const misc_t m)
+            : nonexacts(ne), exacts(e), misc(m), index(items_idx++)
+        {
+        }
+
+        /* Restore a previously found item, e.g. one read back from disk, keeping its index. */
+        explicit item(const nonexacts_t ne, const exacts_t e, const misc_t m, size_t index)
+            : nonexacts(ne), exacts(e), misc(m), index(index)
+        {
+        }
+
 #ifdef DEBUG
         item() : index(0) {}
 #endif
@@ -151,6 +177,12 @@ namespace bookwyrm::core {
          */
         bool matches(const item &wanted, const unsigned int fuzzy_min) const;
 
+        /*
+         * Returns how well the non-exact values match what's wanted, in percent:
+         * the weakest of the fuzzy ratios checked by matches(), or 100 if none are specified.
+         */
+        unsigned int score(const item &wanted) const;
+
         bool operator==(const item &other) const;
 
         /* For keeping sort order in an std::set. */
@@ -7,11 +7,42 @@
 #include <fmt/format.h>
 
 #include "../prefix.hpp"
+#include "batch.hpp"
 #include "plugin_handler.hpp"
 #include "python.hpp"
 
 using namespace bookwyrm::core;
 
+/*
+ * Coerce the message of the pending Python exception out from CPython, along with the line
+ * it was raised on, clearing the exception.
+ */
+static string fetch_python_error()
+{
+    PyObject *ptype = nullptr, *pvalue = nullptr, *ptraceback = nullptr;
+    PyErr_Fetch(&ptype, &pvalue, &ptraceback);
+    PyObject *utf8 = PyObject_Repr(pvalue);
+    PyObject *pystr = PyUnicode_AsEncodedString(utf8, "utf-8", nullptr);
+    const string errmsg = pystr != nullptr ? PyBytes_AS_STRING(pystr) : "unknown error";
+
+    /* Find where the error was thrown. */
+    int lineno = -1;
+    if (auto *traceback = (PyTracebackObject *)ptraceback; traceback != nullptr) {
+        while (traceback->tb_next != nullptr)
+            traceback = traceback->tb_next;
+        lineno = traceback->tb_lineno;
+    }
+
+    /* Decrement reference count of used objects */
+    Py_XDECREF(utf8);
+    Py_XDECREF(pystr);
+    Py_XDECREF(ptype);
+    Py_XDECREF(pvalue);
+    Py_XDECREF(ptraceback);
+
+    return fmt::format("(line: {}): {}", lineno, errmsg);
+}
+
 plugin_handler::plugin_handler(const item &&wanted, bool debug, const options options)
     : wanted_(wanted), debug_(debug), options_(options)
 {
@@ -64,6 +95,20 @@ void plugin_handler::load_plugins()
      */
     std::ignore = py::module::import("pybookwyrm");
 
+    /* Refreshed results are only as fresh as the pages they're parsed from. */
+    if (!options_.http_cache_path.empty()) {
+        py::module::import("pybookwyrm").attr("http").attr("cache")(options_.http_cache_path.string(),
+                                                                    options_.http_cache_size,
+                                                                    options_.refresh_cache);
+    }
+
+    /* pybookwyrm is a module of its own, with its own client; hand it the share through a capsule. */
+    if (options_.http_share) {
+        py::capsule share(new std::shared_ptr<core::http_share>(options_.http_share),
+                          [](void *p) { delete static_cast<std::shared_ptr<core::http_share> *>(p); });
+        py::module::import("pybookwyrm").attr("http").attr("share")(share);
+    }
+
     for (auto &path : options_.plugin_paths)
         log(log_level::debug, fmt::format("looking for scripts in {}", path.string()));
 
@@ -108,11 +153,42 @@ void plugin_handler::load_plugins()
     if (plugins.empty())
         throw std::runtime_error("couldn't find any valid plugin scripts");
 
+    /*
+     * Identify this search for the result cache. Cached results are invalidated whenever a
+     * plugin changes: by its __version__, if it declares one, otherwise by its modification time.
+     */
+    plugins_key_ = std::hash<unsigned int>()(options_.accuracy);
+    for (auto &module : plugins) {
+        string version = py::hasattr(module, "__version__")
+                             ? string(py::str(module.attr("__version__")))
+                             : std::to_string(fs::last_write_time(string(py::str(module.attr("__file__"))))
+                                                  .time_since_epoch()
+                                                  .count());
+        std::hash_combine(plugins_key_, module.attr("__name__").cast<string>() + '@' + version);
+    }
+    cache_key_ = cache_key(wanted_);
+
     plugins_ = std::move(plugins);
 }
 
+size_t plugin_handler::cache_key(const item &wanted) const
+{
+    size_t key = std::hash<item>()(wanted);
+    std::hash_combine(key, plugins_key_);
+    return key;
+}
+
 plugin_handler::~plugin_handler()
 {
+    /* Items found from now on won't make it into the catalog. */
+    if (catalog_) {
+        try {
+            catalog_->close();
+        } catch (const std::exception &err) {
+            buffer_.emplace_back(log_level::warn, fmt::format("unable to update the local catalog: {}", err.what()));
+        }
+    }
+
     /*
      * Flush log entries.
      * TODO: colour this output to match that of the log screen.
@@ -136,6 +212,19 @@ void plugin_handler::async_search()
     /* Ensure pybind internals are initialized. */
     py::get_shared_data("");
 
+    if (serve_cached() && !options_.refresh_cache) {
+        log(log_level::debug, "serving cached results; no plugins will be run");
+        this->nogil = std::make_unique<py::gil_scoped_release>();
+        return;
+    }
+
+    serve_catalog();
+    if (options_.offline) {
+        log(log_level::debug, "searching offline; no plugins will be run");
+        this->nogil = std::make_unique<py::gil_scoped_release>();
+        return;
+    }
+
     log(log_level::debug, fmt::format("seaching with an accuracy of {}%", options_.accuracy));
     running_plugins_ = plugins_.size();
 
@@ -152,8 +241,122 @@ void plugin_handler::async_search()
     this->nogil = std::make_unique<py::gil_scoped_release>();
 }
 
+void plugin_handler::batch_search(const vector<item> &wanted,
+                                  size_t concurrency,
+                                  const std::function<void(const batch_query &)> &done)
+{
+    assert(!plugins_.empty());
+
+    /* Ensure pybind internals are initialized. */
+    py::get_shared_data("");
+
+    if (!options_.cache_path.empty())
+        cache_ = std::make_unique<result_cache>(options_.cache_path, options_.cache_ttl);
+    open_catalog();
+
+    /*
+     * Serve what we can from the cache and the catalog first; each remaining search is
+     * split into one job per plugin. Jobs are taken in search order, so the earliest
+     * searches are completed first.
+     */
+    vector<std::unique_ptr<batch_query>> queries;
+    vector<std::pair<batch_query *, py::module>> jobs;
+    for (size_t id = 0; id < wanted.size(); id++) {
+        auto query = std::make_unique<batch_query>(id, wanted[id], *this);
+        query->cache_key_ = cache_key(query->wanted);
+
+        if (const auto cached = cache_ ? cache_->load(query->cache_key_) : std::nullopt; cached) {
+            for (const auto &item : *cached) {
+                if (query->insert_item(item))
+                    query->stale_.insert(std::hash<core::item>()(item));
+            }
+
+            if (!options_.refresh_cache) {
+                query->log(log_level::debug, fmt::format("serving {} cached items", cached->size()));
+                done(*query);
+                continue;
+            }
+        }
+
+        if (catalog_) {
+            for (const auto &item : catalog_->find(query->wanted, options_.accuracy))
+                query->insert_item(item);
+        }
+
+        if (options_.offline) {
+            done(*query);
+            continue;
+        }
+
+        query->running_plugins_ = plugins_.size();
+        for (const auto &module : plugins_)
+            jobs.emplace_back(query.get(), module);
+        queries.push_back(std::move(query));
+    }
+
+    log(log_level::debug,
+        fmt::format("running {} of {} searches with at most {} plugins at a time", queries.size(), wanted.size(), concurrency));
+
+    std::atomic<size_t> next_job{0};
+    const auto worker = [this, &jobs, &next_job, &done]() {
+        py::gil_scoped_acquire gil;
+
+        for (size_t job; (job = next_job++) < jobs.size();) {
+            auto & [ query, module ] = jobs[job];
+            batch_runner(*query, module);
+
+            if (--query->running_plugins_ == 0) {
+                if (cache_ && query->complete() && !query->results().empty()) {
+                    const auto stale = std::invoke([&query = *query]() {
+                        std::lock_guard<std::mutex> guard(query.items_mutex_);
+                        return query.stale_;
+                    });
+                    store_results(query->cache_key_, query->results(), stale);
+                }
+
+                py::gil_scoped_release nogil;
+                done(*query);
+            }
+        }
+    };
+
+    /* Let the workers take the GIL in turns while we wait for them. */
+    py::gil_scoped_release nogil;
+    vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(std::max<size_t>(concurrency, 1), jobs.size()); i++)
+        workers.emplace_back(worker);
+    for (auto &thread : workers)
+        thread.join();
+}
+
+void plugin_handler::batch_runner(batch_query &query, py::module module)
+{
+    const string name = module.attr("__name__").cast<string>();
+
+    try {
+        py::object func = module.attr("find");
+        py::tuple args = py::make_tuple(detail::to_py_dict(query.wanted), &query);
+        PyObject *retval = PyObject_Call(func.ptr(), args.ptr(), nullptr);
+
+        if (retval == nullptr) {
+            query.log(log_level::err, fmt::format("plugin '{}' exited non-successfully {}", name, fetch_python_error()));
+            query.plugin_failed_ = true;
+        }
+
+        Py_XDECREF(retval);
+    } catch (const py::error_already_set &err) {
+        query.log(log_level::err, fmt::format("plugin '{}' exited non-successfully: {}", name, err.what()));
+        query.plugin_failed_ = true;
+    } catch (const py::cast_error &err) {
+        query.log(log_level::err, fmt::format("plugin '{}' did something wrong with types: {}", name, err.what()));
+        query.plugin_failed_ = true;
+    }
+}
+
 vector<py::module> plugin_handler::get_plugins()
 {
+    /* Copying a module takes a reference to it; the caller need not hold the GIL. */
+    py::gil_scoped_acquire gil;
     return plugins_;
 }
 
@@ -186,28 +389,13 @@ void plugin_handler::python_module_runner(py::module module)
         PyObject *retval = PyObject_Call(func.ptr(), args.ptr(), nullptr);
 
         /* Check if an exception was thrown */
-        if (retval == nullptr) {
-            /* Coerce the exception error message out from CPython */
-            PyObject *ptype = nullptr, *pvalue = nullptr, *ptraceback = nullptr;
-            PyErr_Fetch(&ptype, &pvalue, &ptraceback);
-            PyObject *utf8 = PyObject_Repr(pvalue);
-            PyObject *pystr = PyUnicode_AsEncodedString(utf8, "utf-8", nullptr);
-            const char *errmsg = PyBytes_AS_STRING(pystr);
-
-            /* Find where the error was thrown. */
-            auto *traceback = (PyTracebackObject *)ptraceback;
-            while (traceback->tb_next != nullptr)
-                traceback = traceback->tb_next;
-            const int lineno = traceback->tb_lineno;
-
-            /* Decrement reference count of used objects */
-            Py_XDECREF(utf8);
-            Py_XDECREF(pystr);
-            Py_XDECREF(ptype);
-            Py_XDECREF(pvalue);
-            Py_XDECREF(ptraceback);
-
-            log(log_level::err, fmt::format("plugin '{}' exited non-successfully (line: {}): {}", name, lineno, errmsg));
+        if (retval == nullptr && stopped_) {
+            /* Most likely raised by feed() to stop the plugin. */
+            PyErr_Clear();
+            log(log_level::debug, fmt::format("stopped plugin '{}'", name));
+        } else if (retval == nullptr) {
+            log(log_level::err, fmt::format("plugin '{}' exited non-successfully {}", name, fetch_python_error()));
+            plugin_failed_ = true;
         }
 
         Py_XDECREF(retval);
@@ -225,6 +413,7 @@ void plugin_handler::python_module_runner(py::module module)
         throw;
     } catch (const py::error_already_set &err) {
         log(log_level::err, fmt::format("plugin '{}' exited non-successfully: {}", name, err.what()));
+        plugin_failed_ = true;
     } catch (const py::cast_error &err) {
         log(log_level::err,
             fmt::format("plugin '{}' did something wrong with types; "
@@ -232,23 +421,29 @@ void plugin_handler::python_module_runner(py::module module)
                         "Details: {}",
                         name,
                         err.what()));
+        plugin_failed_ = true;
     }
 
     /* Propegate that this plugin is terminating */
     log(log_level::debug, fmt::format("exiting plugin '{}'", name));
-    running_plugins_--;
+    const bool last = --running_plugins_ == 0;
+    if (last)
+        store_cached();
     if (auto fe = frontend_.lock(); fe)
         fe->update();
+
+    if (last) {
+        /* Notify under the lock, so that a waiter can't miss it between its check and its wait. */
+        std::lock_guard<std::mutex> guard(done_mutex_);
+        done_.notify_all();
+    }
 }
 
-#ifdef DEBUG
 void plugin_handler::wait()
 {
-    /* TODO: dont poll */
-    while (running_plugins_ != 0)
-        ;
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    done_.wait(lock, [this]() { return running_plugins_ == 0; });
 }
-#endif
 
 void plugin_handler::wait_for_item()
 {
@@ -257,19 +452,27 @@ void plugin_handler::wait_for_item()
         ;
 }
 
+void plugin_handler::stop()
+{
+    stopped_ = true;
+    log(log_level::debug, "stopping all plugins");
+}
+
 void plugin_handler::add_item(py::dict dict)
 {
+    if (stopped_)
+        throw std::runtime_error("the search has been stopped");
+
     const item item(dict);
     log(log_level::debug, fmt::format("trying to add one new item with title '{}'...", item.nonexacts.title));
+
+    catalog_item(item);
     if (item.nonexacts.title.empty() || !item.matches(wanted_, options_.accuracy) || item.misc.uris.size() == 0) {
         log(log_level::debug, "item not a match close enough, or missing title/URI; ignored.");
         return;
     }
 
-    std::lock_guard<std::mutex> guard(items_mutex_);
-
-    bool inserted = false;
-    std::tie(std::ignore, inserted) = items_.insert(item);
+    const bool inserted = insert_item(item);
 
     if (inserted)
         log(log_level::debug, "added one new item");
@@ -280,6 +483,136 @@ void plugin_handler::add_item(py::dict dict)
         fe->update();
 }
 
+bool plugin_handler::insert_item(const item &item)
+{
+    bool spilled_first = false;
+    {
+        std::lock_guard<std::mutex> guard(items_mutex_);
+
+        const size_t hash = std::hash<core::item>()(item);
+        if (!seen_.insert(hash).second) {
+            /* Found again, so a served cached item is still valid. */
+            stale_.erase(hash);
+            return false;
+        }
+
+        if (options_.max_results == 0 || items_.size() < options_.max_results) {
+            items_.insert(item);
+        } else {
+            /* The in-memory window is full; keep the item on disk instead. */
+            if (!spill_) {
+                spill_ = std::make_unique<spill>();
+                spilled_first = true;
+            }
+
+            spill_->push_back(item);
+        }
+    }
+
+    /* The frontend reads found items on update, so the lock must be released before it is notified. */
+    if (spilled_first)
+        log(log_level::debug,
+            fmt::format("found more than {} items; spilling the remaining items to disk", options_.max_results));
+
+    if (auto fe = frontend_.lock(); fe)
+        fe->found(item);
+
+    return true;
+}
+
+bool plugin_handler::serve_cached()
+{
+    if (options_.cache_path.empty())
+        return false;
+
+    cache_ = std::make_unique<result_cache>(options_.cache_path, options_.cache_ttl);
+    const auto cached = cache_->load(cache_key_);
+    if (!cached)
+        return false;
+
+    /* No plugin is running yet, so there is no need to hold the lock between these. */
+    for (const auto &item : *cached) {
+        if (insert_item(item))
+            stale_.insert(std::hash<core::item>()(item));
+    }
+
+    log(log_level::debug, fmt::format("found {} cached items", cached->size()));
+    return true;
+}
+
+void plugin_handler::serve_catalog()
+{
+    if (!open_catalog())
+        return;
+
+    size_t served = 0;
+    for (const auto &item : catalog_->find(wanted_, options_.accuracy)) {
+        if (insert_item(item))
+            served++;
+    }
+
+    log(log_level::debug, fmt::format("found {} items in the local catalog of {} items", served, catalog_->size()));
+}
+
+void plugin_handler::store_cached()
+{
+    /* Only cache complete results, and never cache failure. */
+    if (!cache_ || plugin_failed_ || stopped_ || result_count() == 0)
+        return;
+
+    const auto stale = std::invoke([this]() {
+        std::lock_guard<std::mutex> guard(items_mutex_);
+        return stale_;
+    });
+
+    store_results(cache_key_, results(0, result_count()), stale);
+}
+
+void plugin_handler::store_results(size_t key, const vector<item> &found, const std::unordered_set<size_t> &stale)
+{
+    /* Skip served cached items that the plugins did not find again. */
+    vector<item> fresh;
+    for (const auto &item : found) {
+        if (stale.count(std::hash<core::item>()(item)) == 0)
+            fresh.push_back(item);
+    }
+
+    try {
+        cache_->store(key, fresh);
+        log(log_level::debug, fmt::format("cached {} found items", fresh.size()));
+    } catch (const std::exception &err) {
+        log(log_level::warn, fmt::format("unable to cache found items: {}", err.what()));
+    }
+}
+
+bool plugin_handler::open_catalog()
+{
+    if (options_.catalog_path.empty())
+        return false;
+
+    try {
+        catalog_ = std::make_unique<catalog>(options_.catalog_path);
+    } catch (const std::exception &err) {
+        log(log_level::warn, fmt::format("unable to open the local catalog: {}", err.what()));
+        return false;
+    }
+
+    return true;
+}
+
+void plugin_handler::catalog_item(const item &item)
+{
+    /* Catalog anything that could be served later, even if it isn't what's wanted now. */
+    if (!catalog_ || item.nonexacts.title.empty() || item.misc.uris.size() == 0)
+        return;
+
+    try {
+        catalog_->add(item);
+    } catch (const std::exception &err) {
+        log(log_level::warn, fmt::format("unable to add item to the local catalog: {}", err.what()));
+    }
+}
+
 void plugin_handler::log(log_level lvl, string msg)
 {
     std::lock_guard<std::mutex> guard(frontend_mutex_);
@@ -292,9 +625,30 @@ void plugin_handler::log(log_level lvl, string msg)
     }
 }
 
-const std::set<item> &plugin_handler::search_results() const
+size_t plugin_handler::result_count() const
+{
+    std::lock_guard<std::mutex> guard(items_mutex_);
+    return items_.size() + (spill_ ? spill_->size() : 0);
+}
+
+vector<item> plugin_handler::results(size_t first, size_t count) const
 {
-    return items_;
+    std::lock_guard<std::mutex> guard(items_mutex_);
+    vector<item> found;
+
+    /* Positions within the in-memory window come first, in the order they were found. */
+    if (first < items_.size()) {
+        for (auto it = std::next(items_.cbegin(), first); it != items_.cend() && found.size() < count; it++)
+            found.push_back(*it);
+    }
+
+    if (spill_) {
+        const size_t spill_first = first + found.size() - items_.size();
+        for (size_t i = spill_first; i < spill_->size() && found.size() < count; i++)
+            found.push_back(spill_->at(i));
+    }
+
+    return found;
 }
 
 void plugin_handler::set_frontend(std::shared_ptr<frontend> fe)
@@ -1,21 +1,30 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <experimental/filesystem>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <thread>
 #include <unistd.h>
+#include <unordered_set>
 
+#include "cache.hpp"
+#include "catalog.hpp"
 #include "hash.hpp"
 #include "item.hpp"
 #include "python.hpp"
+#include "spill.hpp"
 
 namespace fs = std::experimental::filesystem;
 
 namespace bookwyrm::core {
 
+    class http_share;
+
     enum class log_level { trace = 0, debug = 1, info = 2, warn = 3, err = 4, critical = 5, off = 6 };
     using log_pair = std::pair<core::log_level, std::string>;
 
@@ -38,8 +47,35 @@ namespace bookwyrm::core {
         vector<fs::path> plugin_paths;
         string library_path;
         unsigned int accuracy = 75;
+
+        /* How many found items to keep in memory; the rest are spilled to disk. 0 means unbounded. */
+        size_t max_results = 0;
+
+        /* Where to cache search results. Caching is disabled if empty. */
+        fs::path cache_path;
+
+        /* For how long cached results are served. */
+        std::chrono::seconds cache_ttl = std::chrono::hours(24);
+
+        /* Should plugins still be run when cached results are served, refreshing the cache? */
+        bool refresh_cache = false;
+
+        /* Where to cache the pages plugins fetch with pybookwyrm.http, and how many bytes of them. Disabled if empty. */
+        fs::path http_cache_path;
+        uintmax_t http_cache_size = uintmax_t{64} << 20;
+
+        /* The DNS and TLS session caches pybookwyrm.http shares with the rest of bookwyrm, if any. */
+        std::shared_ptr<core::http_share> http_share;
+
+        /* Where the local catalog of all items ever found is kept. The catalog is disabled if empty. */
+        fs::path catalog_path;
+
+        /* Only search the local catalog; don't run any plugins. */
+        bool offline = false;
     };
 
+    class batch_query;
+
     class frontend {
     public:
         virtual ~frontend() {}
@@ -49,6 +85,9 @@ namespace bookwyrm::core {
 
         /* Log something to the frontend with a fitting level. */
         virtual void log(const log_level level, const std::string message) = 0;
+
+        /* Called with each found item as soon as it has been accepted, before update(). */
+        virtual void found(const core::item &item) { std::ignore = item; }
     };
 
     class backend {
@@ -57,8 +96,14 @@ namespace bookwyrm::core {
 
         virtual size_t running_plugins() const = 0;
 
-        /* Found items are immutable outside of backend. */
-        virtual const std::set<core::item> &search_results() const = 0;
+        /* How many items have been found thus far? */
+        virtual size_t result_count() const = 0;
+
+        /*
+         * Copy out at most `count` found items, starting at position `first`.
+         * Found items are immutable outside of backend.
+         */
+        virtual vector<core::item> results(size_t first, size_t count) const = 0;
     };
 
     class __attribute__((visibility("hidden"))) plugin_handler : public backend {
@@ -84,30 +129,59 @@ namespace bookwyrm::core {
 
         /**
          * @brief Start searching with a dedicated thread for each found plugin
+         *
+         * If results for the same search are cached, those are served instead,
+         * and plugins are only run if options::refresh_cache is set. Otherwise,
+         * matching items from the local catalog are served before any plugin is run.
+         *
          * @warning Should be called after the \ref plugin_handler::load_plugins
          * function
          */
         void async_search();
 
+        /**
+         * @brief Run many searches with the loaded plugins, and block until all are done
+         *
+         * Each plugin is run once per search, with at most `concurrency` plugin runs
+         * at a time. `done` is called, possibly from another thread and concurrently
+         * with other searches, as each search completes; in completion order, not input
+         * order. The result cache and the local catalog are used as in async_search().
+         *
+         * @warning Should be called after the \ref plugin_handler::load_plugins
+         * function, instead of \ref plugin_handler::async_search
+         */
+        void batch_search(const vector<item> &wanted,
+                          size_t concurrency,
+                          const std::function<void(const batch_query &)> &done);
+
         /**
          * @brief Copy loaded modules from instance.
+         *
+         * Takes the GIL for the copy, so it may be called after async_search() has released it.
          */
         vector<py::module> get_plugins();
 
-#ifdef DEBUG
         /**
          * @brief Wait for all plugins to finish execution
          * @warning Should be called after the \ref plugin_handler::async_search
          * function
          */
         void wait();
-#endif
 
         /**
          * @brief Wait until one item has been found or until no modules are running.
          */
         void wait_for_item();
 
+        /**
+         * @brief Ask all running plugins to stop searching
+         *
+         * A plugin thread can't be interrupted, so a plugin is stopped by raising an exception
+         * in it the next time it feeds an item. Items found after this are ignored, and the
+         * incomplete results are not cached.
+         */
+        void stop();
+
         /**
          * @brief Try to add a found item, and the update the set frontend.
          * @param dict Python dictionary containing all item information
@@ -126,11 +200,17 @@ namespace bookwyrm::core {
         void log(log_level lvl, std::string msg);
 
         /**
-         * @brief Return all found items
+         * @brief Return how many items have been found, including those spilled to disk
+         */
+        size_t result_count() const;
+
+        /**
+         * @brief Return a range of found items
          *
-         * TODO [doc] return const and make const
+         * Items within the in-memory window are copied; spilled items are decoded
+         * from disk.
          */
-        const std::set<core::item> &search_results() const;
+        vector<core::item> results(size_t first, size_t count) const;
 
         /**
          * @brief Set the frontend that we want to notify on updates
@@ -140,17 +220,57 @@ namespace bookwyrm::core {
         void clear_frontend();
         void clear_nogil() { delete this->nogil.release(); }
 
+        /**
+         * @brief Release the GIL until destruction, as async_search() does, without searching
+         *
+         * For when only the loaded modules are wanted, as by a resolver running on other threads.
+         * @warning Should be called after the \ref plugin_handler::load_plugins function
+         */
+        void release_gil() { this->nogil = std::make_unique<py::gil_scoped_release>(); }
+
         /**
          * @brief Return how many plugins are still searching
          */
         size_t running_plugins() const { return running_plugins_.load(); }
 
-        inline size_t items() { return items_.size(); }
+        inline size_t items() { return result_count(); }
 
     private:
+        friend class batch_query;
+
         static bool readable_file(const fs::path &path);
         void python_module_runner(py::module module);
 
+        /* Run a plugin for one search of a batch. */
+        void batch_runner(batch_query &query, py::module module);
+
+        /* Identifies a search for the wanted item in the result cache. */
+        size_t cache_key(const item &wanted) const;
+
+        /*
+         * Add a matched item, unless an equal item has already been found.
+         * Must not be called with items_mutex_ held. Returns true if the item was added.
+         */
+        bool insert_item(const item &item);
+
+        /* Add cached results for this search, if any. Returns true on a cache hit. */
+        bool serve_cached();
+
+        /* Write the found items to the cache. Called once all plugins have finished. */
+        void store_cached();
+
+        /* Cache found items under the given key, skipping served cached items that were not found again. */
+        void store_results(size_t key, const vector<item> &found, const std::unordered_set<size_t> &stale);
+
+        /* Open the local catalog and add all matching items in it. */
+        void serve_catalog();
+
+        /* Open the local catalog. Returns false, after logging why, if it can't be opened. */
+        bool open_catalog();
+
+        /* Add an item fed by a plugin to the catalog, if it could be served later. */
+        void catalog_item(const item &item);
+
         /* The item to propagate to all plugins. */
         const core::item wanted_;
 
@@ -162,8 +282,33 @@ namespace bookwyrm::core {
         /* Somewhere to store our found items. */
         std::set<core::item> items_;
 
-        /* A lock for when multiple threads want to add an item. */
-        std::mutex items_mutex_;
+        /* Found items that did not fit within options::max_results. Created on first use. */
+        std::unique_ptr<spill> spill_;
+
+        /* Hashes of all found items, used to ignore duplicates. */
+        std::unordered_set<size_t> seen_;
+
+        /* Hashes of served cached items that no plugin has found again (yet). */
+        std::unordered_set<size_t> stale_;
+
+        /* A lock for when multiple threads want to add an item, or when a frontend reads them. */
+        mutable std::mutex items_mutex_;
+
+        /* Identifies this search (wanted item, accuracy, and plugin versions) in the cache. */
+        size_t cache_key_ = 0;
+
+        /* The part of the cache key shared by all searches: the accuracy and plugin versions. */
+        size_t plugins_key_ = 0;
+        std::unique_ptr<result_cache> cache_;
+
+        /* Every item fed by a plugin is added here, matched or not. */
+        std::unique_ptr<catalog> catalog_;
+
+        /* Did any plugin exit non-successfully? If so, the found items are not cached. */
+        std::atomic<bool> plugin_failed_{false};
+
+        /* Has the search been stopped? */
+        std::atomic<bool> stopped_{false};
 
         /*
          * Buffer log entries until a frontend is available.
@@ -176,6 +321,10 @@ namespace bookwyrm::core {
 
         std::atomic<size_t> running_plugins_{0};
 
+        /* Notified when the last running plugin has finished. */
+        std::mutex done_mutex_;
+        std::condition_variable done_;
+
         /* Python-specific; do not change the order of this. */
         py::scoped_interpreter interp;
         vector<std::thread> threads_;
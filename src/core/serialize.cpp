@@ -0,0 +1,261 @@
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "serialize.hpp"
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the serialized item format assumes a little-endian host");
+
+namespace bookwyrm::core::serialize {
+
+    template <typename T> static T read_at(std::string_view data, size_t offset)
+    {
+        T value;
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T> static void write_at(string &buf, size_t offset, T value)
+    {
+        std::memcpy(buf.data() + offset, &value, sizeof(T));
+    }
+
+    static size_t slot_of(field f) { return header_size + static_cast<size_t>(f) * slot_size; }
+
+    /* Where each field of an item is found. */
+
+    static int integer_of(const item &item, field f)
+    {
+        switch (f) {
+        case field::ymod:
+            return static_cast<int>(item.exacts.ymod);
+        case field::year:
+            return item.exacts.year;
+        case field::volume:
+            return item.exacts.volume;
+        case field::number:
+            return item.exacts.number;
+        case field::pages:
+            return item.exacts.pages;
+        case field::size:
+            return item.exacts.size;
+        default:
+            throw std::logic_error("not an integer field");
+        }
+    }
+
+    static const string &string_of(const item &item, field f)
+    {
+        switch (f) {
+        case field::extension:
+            return item.exacts.extension;
+        case field::title:
+            return item.nonexacts.title;
+        case field::series:
+            return item.nonexacts.series;
+        case field::publisher:
+            return item.nonexacts.publisher;
+        case field::journal:
+            return item.nonexacts.journal;
+        case field::edition:
+            return item.nonexacts.edition;
+        case field::origin_plugin:
+            return item.misc.origin_plugin;
+        default:
+            throw std::logic_error("not a string field");
+        }
+    }
+
+    static const vector<string> &strings_of(const item &item, field f)
+    {
+        switch (f) {
+        case field::authors:
+            return item.nonexacts.authors;
+        case field::uris:
+            return item.misc.uris;
+        case field::isbns:
+            return item.misc.isbns;
+        case field::mirrors:
+            return item.misc.mirrors;
+        default:
+            throw std::logic_error("not a list field");
+        }
+    }
+
+    size_t record_length(std::string_view data)
+    {
+        if (data.size() < sizeof(uint32_t))
+            return 0;
+        return read_at<uint32_t>(data, 0);
+    }
+
+    void encode(const item &item, string &buf)
+    {
+        /* Offsets are relative to the start of the record, not the buffer. */
+        const size_t start = buf.size();
+        string record(header_size + schema.size() * slot_size, '\0');
+
+        const auto append = [&record](std::string_view str) -> std::pair<uint32_t, uint32_t> {
+            const auto offset = static_cast<uint32_t>(record.size());
+            record.append(str.data(), str.size());
+            return {offset, static_cast<uint32_t>(str.size())};
+        };
+
+        for (size_t i = 0; i < schema.size(); i++) {
+            const auto f = static_cast<field>(i);
+            std::pair<uint32_t, uint32_t> slot;
+
+            switch (schema[i]) {
+            case kind::integer:
+                slot = {static_cast<uint32_t>(integer_of(item, f)), 0};
+                break;
+            case kind::string:
+                slot = append(string_of(item, f));
+                break;
+            case kind::strings: {
+                const auto &strings = strings_of(item, f);
+
+                vector<std::pair<uint32_t, uint32_t>> slots;
+                for (const auto &str : strings)
+                    slots.push_back(append(str));
+
+                slot = {static_cast<uint32_t>(record.size()), static_cast<uint32_t>(strings.size())};
+                for (const auto & [ offset, length ] : slots) {
+                    record.append(slot_size, '\0');
+                    write_at(record, record.size() - slot_size, offset);
+                    write_at(record, record.size() - sizeof(uint32_t), length);
+                }
+                break;
+            }
+            }
+
+            write_at(record, slot_of(f), slot.first);
+            write_at(record, slot_of(f) + sizeof(uint32_t), slot.second);
+        }
+
+        if (record.size() > std::numeric_limits<uint32_t>::max())
+            throw std::length_error("item too large to serialize");
+
+        write_at(record, 0, static_cast<uint32_t>(record.size()));
+        write_at(record, sizeof(uint32_t), version);
+        write_at(record, sizeof(uint32_t) + sizeof(uint16_t), static_cast<uint16_t>(schema.size()));
+
+        buf.resize(start);
+        buf += record;
+    }
+
+    item_view::item_view(std::string_view record)
+    {
+        const size_t length = record_length(record);
+        if (length < header_size || length > record.size())
+            throw std::runtime_error("truncated item record");
+
+        data_ = record.substr(0, length);
+        version_ = read_at<uint16_t>(data_, sizeof(uint32_t));
+        fields_ = read_at<uint16_t>(data_, sizeof(uint32_t) + sizeof(uint16_t));
+
+        if (header_size + size_t(fields_) * slot_size > length)
+            throw std::runtime_error("malformed item record: slots out of bounds");
+
+        /* Check every reference once, so that the accessors never read out of bounds. */
+        const auto check = [length](size_t offset, size_t size) {
+            if (offset > length || size > length - offset)
+                throw std::runtime_error("malformed item record: field out of bounds");
+        };
+
+        for (size_t i = 0; i < std::min<size_t>(fields_, schema.size()); i++) {
+            const auto[offset, size] = slot(static_cast<field>(i));
+
+            if (schema[i] == kind::string) {
+                check(offset, size);
+            } else if (schema[i] == kind::strings) {
+                check(offset, size_t(size) * slot_size);
+                for (size_t j = 0; j < size; j++)
+                    check(read_at<uint32_t>(data_, offset + j * slot_size),
+                          read_at<uint32_t>(data_, offset + j * slot_size + sizeof(uint32_t)));
+            }
+        }
+    }
+
+    std::pair<uint32_t, uint32_t> item_view::slot(field f) const
+    {
+        const size_t at = slot_of(f);
+        return {read_at<uint32_t>(data_, at), read_at<uint32_t>(data_, at + sizeof(uint32_t))};
+    }
+
+    std::string_view item_view::string_at(size_t slot_offset) const
+    {
+        const auto offset = read_at<uint32_t>(data_, slot_offset),
+                   length = read_at<uint32_t>(data_, slot_offset + sizeof(uint32_t));
+        return data_.substr(offset, length);
+    }
+
+    int item_view::integer(field f) const
+    {
+        /* Fields missing from older records are empty. */
+        if (static_cast<size_t>(f) >= fields_)
+            return empty;
+        return static_cast<int32_t>(slot(f).first);
+    }
+
+    std::string_view item_view::string(field f) const
+    {
+        if (static_cast<size_t>(f) >= fields_)
+            return {};
+        return string_at(slot_of(f));
+    }
+
+    size_t item_view::count(field f) const
+    {
+        if (static_cast<size_t>(f) >= fields_)
+            return 0;
+        return slot(f).second;
+    }
+
+    std::string_view item_view::string(field f, size_t idx) const
+    {
+        if (idx >= count(f))
+            return {};
+        return string_at(slot(f).first + idx * slot_size);
+    }
+
+    item decode(std::string_view data, size_t index)
+    {
+        const item_view view(data);
+
+        const auto str = [&view](field f) { return std::string(view.string(f)); };
+        const auto strs = [&view](field f) {
+            vector<std::string> strings;
+            for (size_t i = 0; i < view.count(f); i++)
+                strings.emplace_back(view.string(f, i));
+            return strings;
+        };
+
+        const int ymod = view.integer(field::ymod);
+        const exacts_t e(ymod == empty ? year_mod::unused : static_cast<year_mod>(ymod),
+                         view.integer(field::year),
+                         view.integer(field::volume),
+                         view.integer(field::number),
+                         view.integer(field::pages),
+                         view.integer(field::size),
+                         str(field::extension));
+
+        const nonexacts_t ne(strs(field::authors),
+                             str(field::title),
+                             str(field::series),
+                             str(field::publisher),
+                             str(field::journal),
+                             str(field::edition));
+
+        const misc_t m(strs(field::uris), strs(field::isbns), strs(field::mirrors), str(field::origin_plugin));
+
+        return item(ne, e, m, index);
+    }
+
+    item decode(std::string_view data)
+    {
+        const item restored = decode(data, 0);
+        return item(restored.nonexacts, restored.exacts, restored.misc);
+    }
+
+} // namespace bookwyrm::core::serialize
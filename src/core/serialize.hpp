@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#include "item.hpp"
+
+/*
+ * A compact binary form of bookwyrm::core::item, shared by everything that moves found
+ * items out of memory: the result spill, the result cache and the local catalog.
+ *
+ * A record is laid out as follows (little-endian, no alignment requirements):
+ *
+ *   length   uint32_t   size of the whole record in bytes, including this field
+ *   version  uint16_t   the schema version the record was written with
+ *   fields   uint16_t   how many slots follow
+ *   slots    fields * 8 bytes, one per schema field, in schema order:
+ *              integer: {int32_t value, uint32_t 0}
+ *              string:  {uint32_t offset, uint32_t length}
+ *              strings: {uint32_t offset, uint32_t count}, where offset points to
+ *                       `count` string slots
+ *   heap     string bytes and string slot arrays; offsets are relative to the record start
+ *
+ * Fields are only ever appended to the schema. A reader ignores slots it does not know of, and
+ * fields missing from an older record read as empty, so records stay readable across versions.
+ */
+
+namespace bookwyrm::core::serialize {
+
+    constexpr uint16_t version = 1;
+
+    enum class kind : uint8_t { integer, string, strings };
+
+    enum class field : uint16_t {
+        // clang-format off
+        ymod, year, volume, number, pages, size, extension,
+        authors, title, series, publisher, journal, edition,
+        uris, isbns, mirrors, origin_plugin,
+        // clang-format on
+    };
+
+    /* The kind of each field, indexed by field. */
+    constexpr std::array<kind, 17> schema = {{
+        // clang-format off
+        kind::integer, kind::integer, kind::integer, kind::integer, kind::integer, kind::integer, kind::string,
+        kind::strings, kind::string, kind::string, kind::string, kind::string, kind::string,
+        kind::strings, kind::strings, kind::strings, kind::string,
+        // clang-format on
+    }};
+
+    constexpr size_t header_size = sizeof(uint32_t) + 2 * sizeof(uint16_t), slot_size = 2 * sizeof(uint32_t);
+
+    /*
+     * Returns the length of the record at the start of the data, as read from its header,
+     * or 0 if not even the header fits.
+     */
+    size_t record_length(std::string_view data);
+
+    /* Append the record of an item to a buffer. The index of the item is not encoded. */
+    void encode(const item &item, string &buf);
+
+    /*
+     * A read-only view of an encoded record. Nothing is copied: all strings point into the
+     * underlying buffer (e.g. a memory-mapped file), which must outlive the view.
+     */
+    class item_view {
+    public:
+        /* Validates the record; throws std::runtime_error if it is truncated or malformed. */
+        explicit item_view(std::string_view record);
+
+        int integer(field f) const;
+        std::string_view string(field f) const;
+
+        /* For fields of kind::strings. Out-of-range elements are empty. */
+        size_t count(field f) const;
+        std::string_view string(field f, size_t idx) const;
+
+        uint16_t version() const { return version_; }
+
+        /* The whole record. */
+        std::string_view data() const { return data_; }
+
+    private:
+        std::pair<uint32_t, uint32_t> slot(field f) const;
+        std::string_view string_at(size_t slot_offset) const;
+
+        std::string_view data_;
+        uint16_t version_, fields_;
+    };
+
+    /*
+     * Decode an item previously encoded with encode(), giving it the passed index.
+     * Throws std::runtime_error if the data is truncated or malformed.
+     */
+    item decode(std::string_view data, size_t index);
+
+    /* Like the above, but the item is given a new index, as if it was just found. */
+    item decode(std::string_view data);
+
+} // namespace bookwyrm::core::serialize
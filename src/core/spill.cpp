@@ -0,0 +1,79 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+#include "serialize.hpp"
+#include "spill.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace bookwyrm::core {
+
+    /* The mapping starts at 1MiB and doubles whenever it is full. */
+    constexpr size_t initial_capacity = 1 << 20;
+
+    spill::spill()
+    {
+        string path = (fs::temp_directory_path() / "bookwyrm-spill.XXXXXX").string();
+        fd_ = mkstemp(path.data());
+        if (fd_ == -1)
+            throw std::runtime_error(fmt::format("unable to create spill file {}: {}", path, std::strerror(errno)));
+
+        /* Nobody else needs to see the file; it is removed as soon as we close it. */
+        unlink(path.c_str());
+    }
+
+    spill::~spill()
+    {
+        if (map_ != nullptr)
+            munmap(map_, capacity_);
+        close(fd_);
+    }
+
+    void spill::reserve(size_t len)
+    {
+        if (used_ + len <= capacity_)
+            return;
+
+        size_t capacity = std::max(capacity_, initial_capacity);
+        while (used_ + len > capacity)
+            capacity *= 2;
+
+        if (ftruncate(fd_, capacity) != 0)
+            throw std::runtime_error(fmt::format("unable to grow spill file: {}", std::strerror(errno)));
+
+        void *map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED)
+            throw std::runtime_error(fmt::format("unable to map spill file: {}", std::strerror(errno)));
+
+        if (map_ != nullptr)
+            munmap(map_, capacity_);
+
+        map_ = static_cast<char *>(map);
+        capacity_ = capacity;
+    }
+
+    void spill::push_back(const item &item)
+    {
+        string buf;
+        serialize::encode(item, buf);
+
+        reserve(buf.size());
+        std::memcpy(map_ + used_, buf.data(), buf.size());
+        records_.push_back({used_, buf.size(), item.index});
+        used_ += buf.size();
+    }
+
+    item spill::at(size_t idx) const
+    {
+        const auto &rec = records_.at(idx);
+        return serialize::decode({map_ + rec.offset, rec.length}, rec.index);
+    }
+
+} // namespace bookwyrm::core
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "item.hpp"
+
+namespace bookwyrm::core {
+
+    /*
+     * An append-only store of found items, backed by a memory-mapped temporary file.
+     *
+     * When a search is bounded by options::max_results, items that do not fit in the
+     * in-memory result window are spilled here in their serialized form, and are only
+     * decoded again when a frontend asks for them (e.g. when scrolled into view).
+     * Only the position of each record is kept in memory.
+     */
+    class spill {
+    public:
+        /* Creates an anonymous (already unlinked) file in the temporary directory. */
+        explicit spill();
+        explicit spill(const spill &) = delete;
+        ~spill();
+
+        void push_back(const item &item);
+
+        /* Decode the idx:th spilled item. */
+        item at(size_t idx) const;
+
+        size_t size() const { return records_.size(); }
+
+    private:
+        /* Ensure that at least `len` more bytes fit in the mapping, growing the file if needed. */
+        void reserve(size_t len);
+
+        struct record {
+            size_t offset, length, index;
+        };
+
+        int fd_ = -1;
+        char *map_ = nullptr;
+        size_t capacity_ = 0, used_ = 0;
+
+        vector<record> records_;
+    };
+
+} // namespace bookwyrm::core
@@ -2,11 +2,27 @@
 #include <clocale>
 #include <csignal>
 #include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <mutex>
 #include <system_error>
+#include <thread>
 #include <unistd.h>
+#include <utility>
 
+#include "components/batch.hpp"
 #include "components/command_line.hpp"
+#include "components/download_queue.hpp"
 #include "components/downloader.hpp"
+#include "components/json.hpp"
+#include "components/json_lines.hpp"
+#include "components/resolver.hpp"
+#include "components/scoreboard.hpp"
+#include "components/selector.hpp"
+#include "core/batch.hpp"
+#include "core/http_share.hpp"
 #include "core/item.hpp"
 #include "core/plugin_handler.hpp"
 #include "prefix.hpp"
@@ -38,13 +54,112 @@ static std::error_code validate_download_dir(const fs::path &path)
     return {};
 }
 
-static const core::item create_item(const cliparser &cli)
+/* Where bookwyrm keeps its cached data: $XDG_CACHE_HOME/bookwyrm, or $HOME/.cache/bookwyrm. */
+static fs::path cache_dir()
 {
-    const core::nonexacts_t ne(
-        cli.get_many("authors"), cli.get("title"), cli.get("series"), cli.get("publisher"), cli.get("journal"));
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0')
+        return fs::path(xdg) / "bookwyrm";
+    if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0')
+        return fs::path(home) / ".cache" / "bookwyrm";
 
-    const auto yearmod = std::invoke([&cli]() -> std::pair<core::year_mod, int> {
-        const auto year_str = cli.get("year");
+    return {};
+}
+
+/* Where bookwyrm keeps its persistent data: $XDG_DATA_HOME/bookwyrm, or $HOME/.local/share/bookwyrm. */
+static fs::path data_dir()
+{
+    if (const char *xdg = std::getenv("XDG_DATA_HOME"); xdg != nullptr && *xdg != '\0')
+        return fs::path(xdg) / "bookwyrm";
+    if (const char *home = std::getenv("HOME"); home != nullptr && *home != '\0')
+        return fs::path(home) / ".local" / "share" / "bookwyrm";
+
+    return {};
+}
+
+/* While set, SIGINT calls this instead of terminating bookwyrm; it is unset once called. */
+static std::mutex interrupt_mutex;
+static std::function<void()> interrupt_handler;
+
+/*
+ * Wait for SIGINT on a thread of its own instead of in a signal handler, so that the handler may
+ * stop downloads cleanly. Must be called before any other thread is started.
+ */
+static void handle_interrupts()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    std::thread([set]() {
+        while (true) {
+            int sig;
+            if (sigwait(&set, &sig) != 0)
+                continue;
+
+            {
+                std::lock_guard<std::mutex> guard(interrupt_mutex);
+                if (auto handler = std::exchange(interrupt_handler, {}); handler) {
+                    handler();
+                    continue;
+                }
+            }
+
+            /*
+             * Without running destructors, which would race the threads still running. Nothing is
+             * lost: journals are at most a second behind, and the download queue is synced as it changes.
+             */
+            std::cout << std::endl;
+            std::_Exit(EXIT_FAILURE);
+        }
+    }).detach();
+}
+
+/* While in scope, the first SIGINT calls the handler instead of terminating bookwyrm. */
+class interrupt_guard {
+public:
+    explicit interrupt_guard(std::function<void()> handler)
+    {
+        std::lock_guard<std::mutex> guard(interrupt_mutex);
+        interrupt_handler = std::move(handler);
+    }
+
+    ~interrupt_guard()
+    {
+        std::lock_guard<std::mutex> guard(interrupt_mutex);
+        interrupt_handler = {};
+    }
+};
+
+/* The search fields passed on the command line, named like their long options. */
+static json::object cli_fields(const cliparser &cli)
+{
+    json::object fields;
+    for (const string opt : {"title", "series", "publisher", "journal", "year", "volume", "number", "extension"}) {
+        if (cli.has(opt))
+            fields[opt] = {cli.get(opt)};
+    }
+    if (cli.has("author"))
+        fields["author"] = cli.get_many("author");
+
+    return fields;
+}
+
+static const core::item create_item(const json::object &fields)
+{
+    const auto get = [&fields](const string &opt) -> string {
+        const auto values = fields.find(opt);
+        return values != fields.cend() && !values->second.empty() ? values->second.front() : "";
+    };
+    const auto get_many = [&fields](const string &opt) -> vector<string> {
+        const auto values = fields.find(opt);
+        return values != fields.cend() ? values->second : vector<string>{};
+    };
+
+    const core::nonexacts_t ne(get_many("author"), get("title"), get("series"), get("publisher"), get("journal"));
+
+    const auto yearmod = std::invoke([&get]() -> std::pair<core::year_mod, int> {
+        const auto year_str = get("year");
         if (year_str.empty())
             return {core::year_mod::equal, core::empty};
 
@@ -84,8 +199,8 @@ static const core::item create_item(const cliparser &cli)
         }
     });
 
-    const auto parse_number = [&cli](const string &&opt) -> int {
-        const auto value_str = cli.get(opt);
+    const auto parse_number = [&get](const string &&opt) -> int {
+        const auto value_str = get(opt);
         if (value_str.empty())
             return core::empty;
 
@@ -96,26 +211,107 @@ static const core::item create_item(const cliparser &cli)
         }
     };
 
-    const core::exacts_t e(yearmod, parse_number("volume"), parse_number("number"), cli.get("extension"));
+    const core::exacts_t e(yearmod, parse_number("volume"), parse_number("number"), get("extension"));
 
     const core::item item(std::move(ne), std::move(e));
 
     return item;
 }
 
+/* A number of bytes, optionally with a K, M or G suffix. Has already been validated. */
+static unsigned long long parse_size(const string &size)
+{
+    const auto unit = std::toupper(size.back());
+    const int shift = unit == 'K' ? 10 : unit == 'M' ? 20 : unit == 'G' ? 30 : 0;
+    return std::stoull(size) << shift;
+}
+
+/* The --auto-select policy. The arguments have already been validated. */
+static selection_policy create_policy(const cliparser &cli)
+{
+    selection_policy policy;
+
+    if (cli.has("prefer")) {
+        std::istringstream exts(cli.get("prefer"));
+        for (string ext; std::getline(exts, ext, ',');) {
+            if (ext = trim(ext, " ."); !ext.empty())
+                policy.extensions.push_back(ext);
+        }
+    }
+
+    if (cli.has("max-size")) {
+        const auto size = parse_size(cli.get("max-size"));
+        policy.max_size = static_cast<int>(std::min<unsigned long long>(size, std::numeric_limits<int>::max()));
+    }
+
+    if (cli.has("min-year"))
+        policy.min_year = std::stoi(cli.get("min-year"));
+    if (cli.has("confidence"))
+        policy.confidence = std::stoi(cli.get("confidence"));
+
+    return policy;
+}
+
+/*
+ * Run every search read from the --batch file with a single plugin handler, and print the
+ * results of each as a line of JSON on stdout as soon as the search has completed.
+ */
+static int run_batch(const cliparser &cli, core::options &&opts)
+{
+    const auto path = cli.get("batch");
+    std::ifstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            fmt::print(stderr, "error: unable to open batch file '{}'\n", path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Validate all searches before running any. */
+    vector<batch::query> queries;
+    vector<core::item> wanted;
+    try {
+        queries = batch::read_queries(path == "-" ? std::cin : file);
+        for (const auto &query : queries) {
+            try {
+                wanted.push_back(create_item(query.fields));
+            } catch (const value_error &err) {
+                throw value_error(fmt::format("line {}: {}", query.line, err.what()));
+            }
+        }
+    } catch (const value_error &err) {
+        fmt::print(stderr, "error: malformed batch input: {}\n", err.what());
+        return EXIT_FAILURE;
+    }
+
+    core::plugin_handler ph(create_item({}), cli.has("debug"), std::move(opts));
+    ph.load_plugins();
+
+    std::mutex output_mutex;
+    const size_t jobs = cli.has("jobs") ? std::stoul(cli.get("jobs")) : 4;
+    ph.batch_search(wanted, jobs, [&queries, &output_mutex](const core::batch_query &query) {
+        string results;
+        for (const auto &item : query.results())
+            results += (results.empty() ? "" : ",") + json::from_item(item);
+
+        const auto line = fmt::format(
+            "{{\"line\":{},\"complete\":{},\"results\":[{}]}}\n", queries[query.id].line, query.complete(), results);
+
+        std::lock_guard<std::mutex> guard(output_mutex);
+        std::fputs(line.c_str(), stdout);
+        std::fflush(stdout);
+    });
+
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
     std::setlocale(LC_ALL, "");
 
-    /* Install a rudimentary SIGINT handler */
-    struct sigaction int_handler;
-    int_handler.sa_handler = [](int) {
-        std::cout << std::endl;
-        std::exit(EXIT_FAILURE);
-    };
-    sigemptyset(&int_handler.sa_mask);
-    int_handler.sa_flags = 0;
-    sigaction(SIGINT, &int_handler, NULL);
+    /* SIGINT terminates bookwyrm, unless downloads are waited for. */
+    handle_interrupts();
 
     /* Define command line options */
     // clang-format off
@@ -137,7 +333,39 @@ int main(int argc, char *argv[])
         ("-h", "--help",       "Display this text and exit")
         ("-v", "--version",    "Print version information (" + build_info_short + ") and exit")
         ("-D", "--debug",      "Set logging level to debug")
-        ("-A", "--accuracy", "Set searching accuracy in percentage (default: 75)", "ACCURACY");
+        ("-A", "--accuracy", "Set searching accuracy in percentage (default: 75)", "ACCURACY")
+        ("-m", "--max-results", "Keep at most MAX found items in memory; "
+                                "the remaining items are spilled to disk (default: unbounded)", "MAX")
+        ("-r", "--refresh",    "Search again even if cached results are available, refreshing the cache")
+        ("-C", "--no-cache",   "Neither use nor update cached search results, fetched pages and resolved mirrors")
+        ("-o", "--offline",    "Only search the local catalog of previously found items")
+        ("-N", "--no-catalog", "Neither search nor add to the local catalog")
+        ("-J", "--json",       "Print each found item as a line of JSON as soon as it is found, "
+                               "instead of opening the user interface; nothing is downloaded")
+        ("-S", "--auto-select", "Pick and download an item without the user interface: the first item found that "
+                                "scores at least CONFIDENCE, or else the best item once all plugins are done")
+        ("-P", "--prefer",     "With --auto-select, only pick items of these comma-separated extensions, "
+                               "preferring the first listed", "EXTS")
+        ("-M", "--max-size",   "With --auto-select, don't pick items larger than SIZE bytes; "
+                               "a K, M or G suffix may be used", "SIZE")
+        ("-Y", "--min-year",   "With --auto-select, only pick items released in or after YEAR", "YEAR")
+        ("-c", "--confidence", "With --auto-select, pick an item the moment one scores at least this many "
+                               "percent (default: 90)", "CONFIDENCE")
+        ("-b", "--batch",      "Run every search in FILE (- for standard input), given as JSON Lines or as CSV "
+                               "with a header row, and print the results of each as a line of JSON", "FILE")
+        ("-j", "--jobs",       "Run at most JOBS plugin searches at a time in batch mode (default: 4)", "JOBS")
+        ("-n", "--parallel",   "Download at most N items at a time (default: 4)", "N")
+        ("-H", "--per-host",   "Open at most N connections to the same host at a time (default: 2)", "N")
+        ("-l", "--limit-rate", "Receive at most RATE bytes a second across all downloads, shared evenly "
+                               "among them; a K, M or G suffix may be used (default: unlimited)", "RATE")
+        ("-u", "--resume",     "Download the items an interrupted run left queued in the download directory, "
+                               "without searching")
+        ("-x", "--xattrs",     "Record the title, authors and origin of downloaded items in extended "
+                               "attributes of their files")
+        ("-R", "--race",       "Start downloading each item from its first N mirrors at once, "
+                               "then keep the fastest and cancel the rest (default: 1)", "N")
+        ("-g", "--segments",   "Split items of 16 MiB or more into N ranges, fetched at once from one or "
+                               "more mirrors, if the server serves ranges (default: 1)", "N");
     // clang-format on
 
     /* Construct a command line parser */
@@ -193,7 +421,6 @@ int main(int argc, char *argv[])
     std::optional<vector<core::item>> wanted_items;
     try {
         /* Construct options */
-        const core::item wanted = create_item(cli);
         core::options opts;
 #ifdef DEBUG
         /* bookwyrm must be run from build/ in DEBUG mode. */
@@ -203,58 +430,187 @@ int main(int argc, char *argv[])
         opts.plugin_paths = {{fs::canonical(fs::path(std::string(INSTALL_PREFIX) + "/share/bookwyrm/plugins"))}};
 #endif
         opts.accuracy = cli.has("accuracy") ? std::stoi(cli.get("accuracy")) : 75;
+        opts.max_results = cli.has("max-results") ? std::stoul(cli.get("max-results")) : 0;
+        if (!cli.has("no-cache") && !cache_dir().empty()) {
+            opts.cache_path = cache_dir() / "results";
+            opts.http_cache_path = cache_dir() / "http";
+        }
+        opts.refresh_cache = cli.has("refresh");
+
+        /* Shared by the downloader and the pages plugins fetch. */
+        const auto share = std::make_shared<core::http_share>();
+        opts.http_share = share;
+        if (!cli.has("no-catalog") && !data_dir().empty())
+            opts.catalog_path = data_dir() / "catalog";
+        opts.offline = cli.has("offline");
         opts.library_path = fmt::format("{}/usr/lib", INSTALL_PREFIX);
 
+        if (cli.has("batch"))
+            return run_batch(cli, std::move(opts));
+
+        const core::item wanted = create_item(cli_fields(cli));
+
         /* Construct and start the plugin handler. */
         auto ph = std::make_shared<core::plugin_handler>(std::move(wanted), cli.has("debug"), std::move(opts));
 
-        /*
-         * Load plugins, search asynchronously, and wait until at least one item has been found
-         * (or until all plugins have finished running).
-         */
-        ph->load_plugins();
-        ph->async_search();
-        ph->wait_for_item();
-
-        /* Display the UI, getting wanted items if any where found and selected. */
-        std::vector<core::log_pair> unread_logs;
-        if (ph->items() != 0) {
-            auto ui = std::make_shared<tui::tui>(ph, cli.has("debug"));
-            ph->set_frontend(ui);
-
-            wanted_items = ui->get_wanted_items();
-            unread_logs = ui->unread_logs();
+        /* Items are downloaded in the background as soon as they are picked; created once plugins are loaded. */
+        std::unique_ptr<bookwyrm::resolver> resolver;
+        bookwyrm::scoreboard scoreboard(data_dir().empty() ? fs::path() : data_dir() / "hosts");
+        bookwyrm::download_queue queue(fs::path(dl_path) / ".bookwyrm-queue");
+        std::unique_ptr<bookwyrm::downloader> downloader;
+        const auto start_downloader = [&]() {
+            fs::path cache;
+            if (!cli.has("no-cache") && !cache_dir().empty())
+                cache = cache_dir() / "mirrors";
+            resolver = std::make_unique<bookwyrm::resolver>(ph->get_plugins(), cache);
+
+            bookwyrm::download_options dl_options;
+            if (cli.has("parallel"))
+                dl_options.max_transfers = std::stoul(cli.get("parallel"));
+            if (cli.has("race"))
+                dl_options.race_mirrors = std::stoul(cli.get("race"));
+            if (cli.has("segments"))
+                dl_options.segments = std::stoul(cli.get("segments"));
+            if (cli.has("per-host"))
+                dl_options.max_per_host = std::stoul(cli.get("per-host"));
+            if (cli.has("limit-rate"))
+                dl_options.max_rate = parse_size(cli.get("limit-rate"));
+            dl_options.tag_files = cli.has("xattrs");
+            downloader = std::make_unique<bookwyrm::downloader>(dl_path, *share, *resolver, scoreboard, queue, dl_options);
+        };
+
+        if (cli.has("json")) {
+            /* Stream found items to stdout until all plugins are done. */
+            auto fe = std::make_shared<json_lines>(cli.has("debug"));
+            ph->set_frontend(fe);
+            ph->load_plugins();
+            ph->async_search();
+            ph->wait();
+            ph->clear_frontend();
+
+            return fe->written() != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
         }
 
-        ph->clear_frontend();
+        if (cli.has("resume")) {
+            /* Download what an earlier run left queued, without searching. */
+            wanted_items = queue.items();
+            if (wanted_items->empty()) {
+                fmt::print(stderr, "Nothing is left to download in {}\n", dl_path);
+                return EXIT_SUCCESS;
+            }
 
-        /* Dump unread logs to stderr */
-        for (const auto &[lvl, msg] : unread_logs) {
-            std::ignore = lvl;
-            fmt::print(stderr, "{}\n", msg);
-        }
+            ph->load_plugins();
+            ph->release_gil();
+            start_downloader();
+        } else if (cli.has("auto-select")) {
+            /* Pick an item as soon as the policy is confident, stopping the search there. */
+            auto fe = std::make_shared<selector>(wanted, create_policy(cli), cli.has("debug"));
+            ph->set_frontend(fe);
+            ph->load_plugins();
+            ph->async_search();
+
+            const auto pick = fe->wait_for_pick(*ph);
+            ph->stop();
+            ph->clear_frontend();
+            start_downloader();
+
+            if (!pick) {
+                fmt::print(stderr, "Unable to find any acceptable items\n");
+                return EXIT_FAILURE;
+            }
 
-        if (ph->items() == 0) {
-            fmt::print(stderr, "Unable to find any items\n");
-            return EXIT_FAILURE;
-        }
+            fmt::print(stderr,
+                       "Picked {} - {} ({}, {})\n",
+                       vector_to_string(pick->nonexacts.authors),
+                       pick->nonexacts.title,
+                       pick->exacts.year,
+                       pick->exacts.extension);
+            wanted_items = {{*pick}};
+        } else {
+            /*
+             * Load plugins, search asynchronously, and wait until at least one item has been found
+             * (or until all plugins have finished running).
+             */
+            ph->load_plugins();
+            ph->async_search();
+            start_downloader();
+            ph->wait_for_item();
+
+            /* Display the UI, getting wanted items if any where found and selected. */
+            std::vector<core::log_pair> unread_logs;
+            if (ph->items() != 0) {
+                /* Download marked items while the user is still picking. */
+                auto ui = std::make_shared<tui::tui>(
+                    ph,
+                    cli.has("debug"),
+                    [&downloader](const core::item &item, bool marked) {
+                        if (marked)
+                            downloader->enqueue(item);
+                        else
+                            downloader->dequeue(item);
+                    },
+                    [&downloader]() {
+                        vector<tui::screen::downloads::entry> entries;
+                        for (const auto &st : downloader->statuses()) {
+                            entries.push_back(
+                                {st.name, static_cast<tui::screen::downloads::entry::state>(st.current), st.dlnow, st.dltotal});
+                        }
+                        return entries;
+                    });
+                ph->set_frontend(ui);
+
+                /* The user interface owns the terminal until it is closed. */
+                downloader->observe(
+                    [ui = ui.get()](bool error, const string &msg) {
+                        ui->log(error ? core::log_level::err : core::log_level::info, msg);
+                    },
+                    [ui = ui.get()]() { ui->downloads_changed(); });
+
+                wanted_items = ui->get_wanted_items();
+                unread_logs = ui->unread_logs();
+                downloader->observe({}, {});
+            }
 
-        if (!wanted_items) {
-            /* We have nothing else to do. */
-            return EXIT_SUCCESS;
-        }
+            ph->clear_frontend();
+
+            /* Dump unread logs to stderr */
+            for (const auto &[lvl, msg] : unread_logs) {
+                std::ignore = lvl;
+                fmt::print(stderr, "{}\n", msg);
+            }
 
-        /* Download wanted selected items. */
-        bookwyrm::downloader d(dl_path);
+            if (ph->items() == 0) {
+                fmt::print(stderr, "Unable to find any items\n");
+                return EXIT_FAILURE;
+            }
 
+            if (!wanted_items) {
+                /* We have nothing else to do; forget what was downloaded meanwhile. */
+                downloader->dequeue_all();
+                downloader->wait();
+                return EXIT_SUCCESS;
+            }
+        }
+
+        /* Download wanted selected items, if they aren't already. */
         if (wanted_items->size() == 1)
             fmt::print(stderr, "Downloading item...\n");
         else
             fmt::print(stderr, "Downloading {} items...\n", wanted_items->size());
 
-        auto plugins = ph->get_plugins();
-        ph->clear_nogil();
-        const auto success = d.sync_download(*wanted_items, plugins);
+        /*
+         * The GIL was released by async_search(), or by release_gil() when resuming, and must stay
+         * so; mirrors are resolved on the resolver's threads, which take it.
+         * The first SIGINT stops the downloads, leaving them queued; a second terminates bookwyrm.
+         */
+        const auto success = std::invoke([&downloader, &wanted_items]() {
+            const interrupt_guard guard([&downloader]() { downloader->interrupt(); });
+            return downloader->sync_download(*wanted_items);
+        });
+        if (downloader->interrupted()) {
+            fmt::print(stderr, "Interrupted; run bookwyrm --resume {} to finish the remaining downloads.\n", dl_path);
+            return EXIT_FAILURE;
+        }
         if (!success) {
             fmt::print(stderr, "No items were successfully downloaded.\n");
             return EXIT_FAILURE;
@@ -21,16 +21,20 @@ import pybookwyrm as bw
 from pdb import set_trace as breakpoint
 
 from pymaybe import maybe
-from bs4 import BeautifulSoup
 from furl import furl
 from collections import deque
 from enum import Enum
 import sys
-import requests
 import re
 import isbnlib
 
 DOMAINS = ('libgen.io',)
+HEADERS = {
+    'User-Agent': 'Mozilla/5.0 (X11; Linux x86_64; rv:63.0) Gecko/20100101 Firefox/63.0'
+}
+
+# How many result pages to request ahead of the one being parsed.
+PREFETCH_PAGES = 2
 DEBUG = __name__ == '__main__'
 
 class FakeLogger():
@@ -217,11 +221,8 @@ class LibgenSeeker(object):
                             self.process_ffiction(table)
                         else:
                             self.bookwyrm.log.warn('unknown path "%s"; ignored.' % path)
-                except requests.exceptions.ConnectionError as e:
-                    self.bookwyrm.log.error('connection error (%s)!' % e)
-                    continue
-                except requests.exceptions.HTTPError as e:
-                    self.bookwyrm.log.error('HTTP error (%s)!' % e)
+                except bw.http.error as e:
+                    self.bookwyrm.log.error('request failed (%s)!' % e)
                     continue
 
                 # That domain worked; do the next query.
@@ -232,7 +233,7 @@ class LibgenSeeker(object):
         """
         A generator that given a start URL, fetches each page of result,
         by supplying a page=n parameter.
-        Yields a soup of the result table.
+        Yields the rows of the result table; see bw.html.tables.
         """
 
         # Both /search.php and /foreignfiction/index.php uses some JavaScript under the name
@@ -245,33 +246,34 @@ class LibgenSeeker(object):
         #     - /foreignfiction/index.php: check if extracted table only contains a single line;
         # When the respective invariant is True, we've gone through all pages.
 
-        p = 1
         query_params = f.args.copy()
 
         table_extractors = {
-            '/search.php': lambda soup: soup.find('table', {'class': 'c', 'rules': 'rows'}, recursive=False),
-            '/foreignfiction/index.php': lambda soup: soup.find_all('table', {'rules': 'rows'})[-1],
+            '/search.php': lambda html: bw.html.tables(html, {'class': 'c', 'rules': 'rows'})[0],
+            '/foreignfiction/index.php': lambda html: bw.html.tables(html, {'rules': 'rows'})[-1],
         }
         exhaust_conditions = {
-            '/search.php': lambda table: len(table.find_all('tr')) == 1,
-            '/foreignfiction/index.php': lambda table: len(table.find_all('tr')) == 0
+            '/search.php': lambda table: len(table) == 1,
+            '/foreignfiction/index.php': lambda table: len(table) == 0
         }
 
-        while True:
-            f.set({'page': p}).add(query_params)
+        def fetch(page):
+            f.set({'page': page}).add(query_params)
+            return bw.http.fetch(f.url, HEADERS)
 
-            # Fetch the page
-            headers = {
-                'User-Agent': 'Mozilla/5.0 (X11; Linux x86_64; rv:63.0) Gecko/20100101 Firefox/63.0'
-            }
-            r = requests.get(f.url, headers=headers)
-            if r.status_code != requests.codes.ok:
-                r.raise_for_status()
+        # Pages are requested ahead, while the current one is parsed; those past the last are unused.
+        pages = deque(fetch(p) for p in range(1, PREFETCH_PAGES + 2))
+        p = len(pages) + 1
+
+        while True:
+            r = pages.popleft().result()
+            pages.append(fetch(p))
+            p += 1
+            r.raise_for_status()
 
             # Extract table
-            soup = BeautifulSoup(r.text, 'html.parser')
             try:
-                table = table_extractors[str(f.path)](soup)
+                table = table_extractors[str(f.path)](r.text)
             except IndexError:
                 # TODO: check for this in exhaust_conditions
                 self.bookwyrm.log.debug('No table found; assuming end of results.')
@@ -283,17 +285,13 @@ class LibgenSeeker(object):
 
             yield table
 
-            p += 1
-
     def process_libgen(self, table):
         """
-        Processes a table soup from LibGen and returns the items found within.
+        Processes a table from LibGen and returns the items found within.
         """
         # TODO: check if the same HTML is given when using gen.lib.rus.ec host.
 
         def make_item(row):
-            columns = row.find_all('td')
-
             # In a row, the first column contains the item's ID number on LibGen.
             # The other columns contain a single piece of data, the raw text of which
             # we aptly extract. The third column, however, contains the item's series
@@ -303,70 +301,65 @@ class LibgenSeeker(object):
             # Also, within this STEI- (series, title, edition, isbsns) field, the title,
             # series, edition and isbsns are all in the same <a>-tag. Fortunately,
             # the title is always in normal text, while the latter are both in their own
-            # <font>-tags.
+            # <font>-tags, so each is its own fragment of the link's text.
 
-            authors, stei, publisher, year, pages, language, \
-                size, extension = columns[1:9]
-            mirrors = columns[9:-1]  # Last column is a link to edit the entry.
+            authors, _, publisher, year, pages, language, \
+                size, extension = [text for text, _ in row[1:9]]
+            stei = row[2][1]  # Only its links are of use.
+            mirrors = row[9:-1]  # Last column is a link to edit the entry.
 
             # If first <a>-tag has title attribute, the item does not have a series.
-            has_series = not stei.a.has_attr('title')
+            has_series = 'title' not in stei[0][0]
 
             # The title, edition, and isbn section always contain an id-attribute with
             # an integer.
-            tei = stei.find_next('a', id=re.compile('\d+$'))
+            tei = next(fragments for attrs, fragments in stei if re.search('\d+$', attrs.get('id', '')))
 
             item = {
-                'series': stei.a.text if has_series else '',
-                'publisher': publisher.text or None,
-                'language': language.text,
-                'authors': authors.text.split(', '),
-                'pages': maybe(re.search('\d+', pages.text)).group(),
-                'size': translate_size(size.text),
-                'extension': extension.text,
-                'mirrors': [m.a['href'] for m in mirrors if m.a != None]
+                'series': ''.join(stei[0][1]) if has_series else '',
+                'publisher': publisher or None,
+                'language': language,
+                'authors': authors.split(', '),
+                'pages': maybe(re.search('\d+', pages)).group(),
+                'size': translate_size(size),
+                'extension': extension,
+                'mirrors': [links[0][0]['href'] for _, links in mirrors if links]
             }
 
             def extract_year(year):
-                if not year.text:
+                if not year:
                     return None
 
                 # Extract the first year found, if any
-                year = maybe(re.search('\d+', year.text)).group()
+                year = maybe(re.search('\d+', year)).group()
                 return int(year) if year else None
 
-            def extract_title():
-                try:
-                    # The title is the first sibling of the first font tag, if any
-                    dd = deque(tei.font.previous_siblings, maxlen=1)
-                    return dd.pop()
-                except AttributeError:
-                    # No edtion or isbn numbers; only the title is given.
-                    return tei.text
+            def is_edition(fragment):
+                # Always surrounded by brackets.
+                return fragment.startswith('[') and fragment.endswith(']')
 
             def extract_edition():
-                # Always surrounded by brackets, so look for those.
-                for font in tei.find_all('font', recursive=False):
-                    if font.text.startswith('[') and font.text.endswith(']'):
-                        return font.text[1:-1].replace('\xa0', ' ')  # replace no-break space
+                for fragment in tei[1:]:
+                    if is_edition(fragment):
+                        return fragment[1:-1].replace('\xa0', ' ')  # replace no-break space
 
             def extract_isbns():
                 def valid_isbn(isbn):
                     return isbnlib.is_isbn10(isbn) or isbnlib.is_isbn13(isbn)
 
                 # Always comma-seperated, so split those and check all elements
-                for font in tei.find_all('font', recursive=False):
-                    if font.text.startswith('[') and font.text.endswith(']'):
+                for fragment in tei[1:]:
+                    if is_edition(fragment):
                         # We stumbled upon the edition, again.
                         continue
-                    return [isbn for isbn in font.text.split(', ') if valid_isbn(isbn)]
+                    return [isbn for isbn in fragment.split(', ') if valid_isbn(isbn)]
 
 
             item = {
                 **item,
-                'title': extract_title().strip(),
+                # The title is the first fragment; any edition or isbn numbers follow it.
+                'title': tei[0].strip() if tei else '',
                 'edition': extract_edition() or None,
-                'authors': authors.text.split(', '),
                 'isbns': extract_isbns() or None,
                 'year': extract_year(year)
             }
@@ -374,33 +367,31 @@ class LibgenSeeker(object):
             return item
 
         # The first row is the columns' headers, so we skip them.
-        for row in table.find_all('tr', recursive=False)[1:]:
+        for row in table[1:]:
             self.feed(make_item(row))
 
     def process_ffiction(self, table):
         """
-        Processes a table soup from LibGen and returns the items found within.
+        Processes a table from LibGen and returns the items found within.
         """
 
         def make_item(row):
-            columns = row.find_all('td')
-
             # esm: extension, size, and mirrors
-            authors, series, title, language, esm = columns
+            (_, authors), (series, _), (title, _), (language, _), (esm, mirrors) = row
 
             item = {
-                'series': series.text or None,
-                'title': title.text,
-                'language': language.text,
-                'extension': maybe(esm.text.split('(')[0])
+                'series': series or None,
+                'title': title,
+                'language': language,
+                'extension': maybe(esm.split('(')[0])
                     .lower()
                     .strip()
                     .or_else(None),
-                'mirrors': [m['href'] for m in esm.find_all('a')],
+                'mirrors': [attrs['href'] for attrs, _ in mirrors if 'href' in attrs],
             }
 
             def extract_size():
-                size = esm.text[esm.text.find('(')+1:esm.text.find(')')]
+                size = esm[esm.find('(')+1:esm.find(')')]
                 size = size.replace('\xa0', ' ')
 
                 if not ' ' in size:
@@ -423,13 +414,13 @@ class LibgenSeeker(object):
             item = {
                 **item,
                 'size': extract_size(),
-                'authors': [flip_names(a.text) for a in authors.find_all('a')]
+                'authors': [flip_names(''.join(fragments)) for _, fragments in authors]
             }
 
             return item
 
         # The first row is the columns' headers, so we skip them.
-        for row in table.find_all('tr')[1:]:
+        for row in table[1:]:
             self.feed(make_item(row))
 
 
@@ -437,13 +428,6 @@ def find(wanted, bookwyrm):
     LibgenSeeker(wanted, bookwyrm).search()
 
 
-# TODO: make this into a neat wrapper, passing the soup as argument
-def get_soup(url):
-    r = requests.get(url)
-    r.raise_for_status()
-    return BeautifulSoup(r.text, 'html.parser')
-
-
 def resolve(mirror):
     try:
         md5 = furl(mirror).args['md5']
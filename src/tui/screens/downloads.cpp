@@ -0,0 +1,99 @@
+#include <algorithm>
+
+#include <fmt/format.h>
+
+#include "screens/downloads.hpp"
+
+namespace bookwyrm::tui::screen {
+
+    downloads::downloads(std::function<std::vector<entry>()> source)
+        : base(default_padding_top, default_padding_bot, default_padding_left, default_padding_right), source_(source)
+    {
+    }
+
+    void downloads::paint()
+    {
+        erase();
+        entries_ = source_();
+
+        if (entries_.empty())
+            print(0, 0, "Nothing is being downloaded. Mark items in the index with [SPACE] to download them.");
+
+        /* Leave room on the right for the progress. */
+        constexpr size_t progress_width = 32;
+        const size_t name_width = get_width() > static_cast<int>(progress_width) ? get_width() - progress_width : 1;
+
+        for (size_t i = scroll_offset_, y = 0; i < entries_.size() && y < static_cast<size_t>(get_height()); i++, y++) {
+            const auto &e = entries_[i];
+            printlim(0, y, e.name, name_width);
+
+            const auto megabytes = [](std::int64_t bytes) { return static_cast<double>(bytes) / (1 << 20); };
+            switch (e.current) {
+            case entry::state::queued:
+                print_right_align(y, "queued", colour::yellow);
+                break;
+            case entry::state::active:
+                print_right_align(y,
+                                  fmt::format("{:3.0f}% {:.2f}/{:.2f}MB",
+                                              e.dltotal > 0 ? 100.0 * e.dlnow / e.dltotal : 0.0,
+                                              megabytes(e.dlnow),
+                                              megabytes(e.dltotal)));
+                break;
+            case entry::state::done:
+                print_right_align(y, fmt::format("done {:.2f}MB", megabytes(e.dltotal)), colour::green);
+                break;
+            case entry::state::failed:
+                print_right_align(y, "failed; see the log", colour::red);
+                break;
+            }
+        }
+
+        refresh();
+    }
+
+    void downloads::move(move_direction dir)
+    {
+        const size_t capacity = get_height(), last = entries_.size() > capacity ? entries_.size() - capacity : 0;
+
+        switch (dir) {
+        case up:
+            if (scroll_offset_ > 0)
+                scroll_offset_--;
+            break;
+        case down:
+            if (scroll_offset_ < last)
+                scroll_offset_++;
+            break;
+        case top:
+            scroll_offset_ = 0;
+            break;
+        case bot:
+            scroll_offset_ = last;
+            break;
+        }
+    }
+
+    std::string downloads::footer_info() const
+    {
+        const auto count = [this](entry::state state) {
+            return std::count_if(entries_.cbegin(), entries_.cend(), [state](const auto &e) { return e.current == state; });
+        };
+
+        return fmt::format("Downloads: {} done, {} running, {} queued, {} failed",
+                           count(entry::state::done),
+                           count(entry::state::active),
+                           count(entry::state::queued),
+                           count(entry::state::failed));
+    }
+
+    std::string downloads::controls_legacy() const { return "[j/k d/u G/g]Navigation [D]Close downloads"; }
+
+    int downloads::scrollpercent() const
+    {
+        if (entries_.size() <= static_cast<size_t>(get_height()))
+            return scroll::not_applicable;
+
+        return ratio(scroll_offset_ + get_height(), entries_.size());
+    }
+
+} // namespace bookwyrm::tui::screen
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "screens/base.hpp"
+
+namespace bookwyrm::tui::screen {
+
+    /* Lists the items marked for download, and how their downloads are going. */
+    class downloads : public base {
+    public:
+        /* An item marked for download, as the downloader sees it. */
+        struct entry {
+            enum class state { queued, active, done, failed };
+
+            std::string name;
+            state current;
+            std::int64_t dlnow, dltotal;
+        };
+
+        /* The entries are fetched from the source anew on each paint. */
+        explicit downloads(std::function<std::vector<entry>()> source);
+
+        void paint() override;
+        void move(move_direction dir) override;
+        std::string footer_info() const override;
+        std::string controls_legacy() const override;
+        int scrollpercent() const override;
+
+    private:
+        const std::function<std::vector<entry>()> source_;
+        std::vector<entry> entries_;
+
+        /* How many lines have we scrolled? */
+        size_t scroll_offset_ = 0;
+    };
+
+} // namespace bookwyrm::tui::screen
@@ -12,9 +12,9 @@ namespace bookwyrm::tui::screen {
         return std::tie(title, width_w, width, startx) == std::tie(other.title, other.width_w, other.width, other.startx);
     }
 
-    index::index(std::set<core::item> const &items)
+    index::index(const core::backend &backend, std::function<void(const core::item &, bool)> on_toggle)
         : base(default_padding_top, default_padding_bot, default_padding_left, default_padding_right), selected_item_(0),
-          scroll_offset_(0), items_(items)
+          scroll_offset_(0), backend_(backend), on_toggle_(on_toggle)
     {
         /*
          * For an example 100px wide window:
@@ -36,9 +36,12 @@ namespace bookwyrm::tui::screen {
     {
         erase();
 
+        /* Only the visible items are fetched. */
+        const auto page = backend_.results(scroll_offset_, capacity());
+
         for (const auto &column : columns_) {
             print_header(column);
-            print_column(column);
+            print_column(column, page);
         }
 
         refresh();
@@ -104,10 +107,14 @@ namespace bookwyrm::tui::screen {
     void index::toggle_action()
     {
         /* Toggle item selection. */
-        if (is_marked(selected_item_))
-            marked_items_.erase(selected_item_);
-        else
+        const bool marked = !is_marked(selected_item_);
+        if (marked)
             marked_items_.insert(selected_item_);
+        else
+            marked_items_.erase(selected_item_);
+
+        if (on_toggle_)
+            on_toggle_(selected_item(), marked);
     }
 
     void index::update_column_widths()
@@ -150,9 +157,9 @@ namespace bookwyrm::tui::screen {
         print(col.startx + x + 1, 0, rune::separator);
     }
 
-    void index::print_column(const column_t &col)
+    void index::print_column(const column_t &col, const vector<core::item> &page)
     {
-        for (size_t i = scroll_offset_, y = 1; i < item_count() && y <= capacity(); i++, y++) {
+        for (size_t i = 0, y = 1; i < page.size() && y <= capacity(); i++, y++) {
 
             const bool on_selected_item = (y + scroll_offset_ == selected_item_ + 1),
                        on_marked_item = is_marked(y + scroll_offset_ - 1);
@@ -167,7 +174,7 @@ namespace bookwyrm::tui::screen {
             }
 
             const auto str = std::invoke([&]() {
-                const auto item = std::next(items_.cbegin(), i);
+                const auto item = &page[i];
 
                 switch (std::find(cbegin(columns_), cend(columns_), col) - cbegin(columns_)) {
                 case 0:
@@ -225,12 +232,9 @@ namespace bookwyrm::tui::screen {
 
     void index::decompress(int scroll) { scroll_offset_ -= scroll; }
 
-    const core::item &index::selected_item() const
-    {
-        return *std::next(items_.cbegin(), static_cast<long int>(selected_item_));
-    }
+    core::item index::selected_item() const { return backend_.results(selected_item_, 1).front(); }
 
-    size_t index::item_count() const { return items_.size(); }
+    size_t index::item_count() const { return backend_.result_count(); }
 
     const std::set<int> &index::marked_items() const { return marked_items_; }
 
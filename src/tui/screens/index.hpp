@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <functional>
 #include <mutex>
 #include <set>
 #include <tuple>
@@ -9,13 +10,15 @@
 
 #include "hash.hpp"
 #include "item.hpp"
+#include "plugin_handler.hpp"
 #include "screens/base.hpp"
 
 namespace bookwyrm::tui::screen {
 
     class index : public base {
     public:
-        explicit index(std::set<core::item> const &items);
+        /* on_toggle is called with each item as it is marked (true) or unmarked (false) for download. */
+        explicit index(const core::backend &backend, std::function<void(const core::item &, bool)> on_toggle = {});
 
         void paint() override;
         void on_resize() override;
@@ -37,7 +40,7 @@ namespace bookwyrm::tui::screen {
         /* Take back the space lent to screen::item_details */
         void decompress(int scroll);
 
-        const core::item &selected_item() const;
+        core::item selected_item() const;
 
         size_t item_count() const;
 
@@ -74,10 +77,12 @@ namespace bookwyrm::tui::screen {
 
         int plugin_count_;
 
-        std::set<core::item> const &items_;
+        /* Found items are fetched from the backend a page at a time; some may not even be in memory. */
+        const core::backend &backend_;
 
         /* Item indices marked for download. */
         std::set<int> marked_items_;
+        const std::function<void(const core::item &, bool)> on_toggle_;
 
         bool is_marked(const size_t idx) const;
 
@@ -87,7 +92,7 @@ namespace bookwyrm::tui::screen {
         void update_column_widths();
 
         void print_header(const column_t &col);
-        void print_column(const column_t &col);
+        void print_column(const column_t &col, const vector<core::item> &page);
     };
 
 } // namespace bookwyrm::tui::screen
@@ -30,7 +30,8 @@ namespace bookwyrm::tui::screen {
         std::string controls_legacy() const override;
 
     private:
-        const core::item &item_;
+        /* A copy: the item may have been decoded from disk just to be displayed here. */
+        const core::item item_;
 
         void print_borders();
         void print_details();
@@ -8,10 +8,14 @@
 
 namespace bookwyrm::tui {
 
-    tui::tui(std::shared_ptr<core::backend> backend, bool log_debug) : viewing_details_(false), backend_(backend)
+    tui::tui(std::shared_ptr<core::backend> backend,
+             bool log_debug,
+             std::function<void(const core::item &, bool)> on_toggle,
+             std::function<std::vector<screen::downloads::entry>()> downloads)
+        : viewing_details_(false), backend_(backend)
     {
         /* Create the index screen and focus on it. */
-        index_ = std::make_shared<screen::index>(backend_->search_results());
+        index_ = std::make_shared<screen::index>(*backend_, on_toggle);
         footer_ = std::make_unique<screen::footer>();
         focused_ = index_;
 
@@ -20,6 +24,9 @@ namespace bookwyrm::tui {
                                              [this]() { return is_log_focused(); });
         log_->log_entry(core::log_level::debug, "the mighty bookwyrm hath been summoned!");
 
+        if (downloads)
+            downloads_ = std::make_shared<screen::downloads>(downloads);
+
         update();
     }
 
@@ -29,8 +36,8 @@ namespace bookwyrm::tui {
         std::lock_guard<std::mutex> guard(paint_mutex_);
 
         index_->prepare(backend_->running_plugins());
-        footer_->prepare(
-            focused_->footer_info(), focused_->scrollpercent(), focused_->controls_legacy(), log_->worst_unread());
+        const auto controls = focused_->controls_legacy() + (downloads_ && focused_ != downloads_ ? " [D]Downloads" : "");
+        footer_->prepare(focused_->footer_info(), focused_->scrollpercent(), controls, log_->worst_unread());
 
         if (!bookwyrm_fits()) {
             curses::werase(stdscr);
@@ -38,6 +45,9 @@ namespace bookwyrm::tui {
         } else if (is_log_focused()) {
             log_->paint();
             footer_->paint();
+        } else if (downloads_ && focused_ == downloads_) {
+            downloads_->paint();
+            footer_->paint();
         } else {
             index_->paint();
 
@@ -53,6 +63,18 @@ namespace bookwyrm::tui {
 
     bool tui::is_log_focused() const { return focused_ == log_; }
 
+    void tui::downloads_changed()
+    {
+        /* Called from the download thread, while the UI thread may move the focus. */
+        {
+            std::lock_guard<std::mutex> guard(paint_mutex_);
+            if (!downloads_ || focused_ != downloads_)
+                return;
+        }
+
+        update();
+    }
+
     void tui::log(const core::log_level level, const std::string message)
     {
         /* Forward to log screen */
@@ -68,6 +90,8 @@ namespace bookwyrm::tui {
             std::lock_guard<std::mutex> guard(paint_mutex_);
             index_->on_resize();
             log_->on_resize();
+            if (downloads_)
+                downloads_->on_resize();
             footer_->on_resize();
         }
 
@@ -123,7 +147,7 @@ namespace bookwyrm::tui {
         std::vector<core::item> items;
 
         for (int idx : index_->marked_items())
-            items.push_back(*std::next(backend_->search_results().cbegin(), idx));
+            items.push_back(backend_->results(idx, 1).front());
 
         return items;
     }
@@ -140,17 +164,22 @@ namespace bookwyrm::tui {
         switch (ch) {
         case 'l':
         case key::arrow_right:
-            if (is_log_focused())
+            if (is_log_focused() || focused_ == downloads_)
                 return false;
             return open_details();
         case 'h':
         case key::arrow_left:
-            if (is_log_focused())
+            if (is_log_focused() || focused_ == downloads_)
                 return false;
             return close_details();
         case key::tab:
             toggle_log();
             return true;
+        case 'D':
+            if (!downloads_ || is_log_focused())
+                return false;
+            toggle_downloads();
+            return true;
         default:
             return false;
         }
@@ -166,7 +195,10 @@ namespace bookwyrm::tui {
         std::tie(index_scrollback_, height) = index_->compress_to(0.20);
 
         details_ = std::make_shared<screen::item_details>(index_->selected_item(), curses::get_height() - height - 1);
-        focused_ = details_;
+        {
+            std::lock_guard<std::mutex> guard(paint_mutex_);
+            focused_ = details_;
+        }
 
         viewing_details_ = true;
         return true;
@@ -177,7 +209,10 @@ namespace bookwyrm::tui {
         if (!viewing_details_)
             return false;
 
-        focused_ = index_;
+        {
+            std::lock_guard<std::mutex> guard(paint_mutex_);
+            focused_ = index_;
+        }
 
         /* Give back the space the detail menu too up to the index menu. */
         index_->decompress(index_scrollback_);
@@ -187,8 +222,20 @@ namespace bookwyrm::tui {
         return true;
     }
 
+    void tui::toggle_downloads()
+    {
+        std::lock_guard<std::mutex> guard(paint_mutex_);
+        if (focused_ != downloads_) {
+            before_downloads_ = focused_;
+            focused_ = downloads_;
+        } else {
+            focused_ = before_downloads_;
+        }
+    }
+
     void tui::toggle_log()
     {
+        std::lock_guard<std::mutex> guard(paint_mutex_);
         if (focused_ != log_) {
             last_ = focused_;
             focused_ = log_;
@@ -3,6 +3,7 @@
 #include "item.hpp"
 #include "plugin_handler.hpp"
 #include "screens/base.hpp"
+#include "screens/downloads.hpp"
 #include "screens/footer.hpp"
 #include "screens/index.hpp"
 #include "screens/item_details.hpp"
@@ -12,7 +13,17 @@ namespace bookwyrm::tui {
 
     class tui : public core::frontend {
     public:
-        explicit tui(std::shared_ptr<core::backend> backend, bool log_debug);
+        /*
+         * on_toggle is called with each item as it is marked (true) or unmarked (false) for download,
+         * e.g. to start downloading it right away. If a source of downloads is given, a screen lists them.
+         */
+        explicit tui(std::shared_ptr<core::backend> backend,
+                     bool log_debug,
+                     std::function<void(const core::item &, bool)> on_toggle = {},
+                     std::function<std::vector<screen::downloads::entry>()> downloads = {});
+
+        /* Repaint the downloads screen, if it is open. */
+        void downloads_changed();
 
         /* Repaint all screens that need updating. */
         void update() override;
@@ -51,6 +62,7 @@ namespace bookwyrm::tui {
         bool close_details();
 
         void toggle_log();
+        void toggle_downloads();
 
         void resize_screens();
 
@@ -69,9 +81,11 @@ namespace bookwyrm::tui {
         std::shared_ptr<screen::index> index_;
         std::shared_ptr<screen::item_details> details_;
         std::shared_ptr<screen::log> log_;
+        std::shared_ptr<screen::downloads> downloads_;
         std::unique_ptr<screen::footer> footer_;
 
-        std::shared_ptr<screen::base> focused_, last_;
+        /* Written under paint_mutex_, as other threads paint; read without it only by the UI thread. */
+        std::shared_ptr<screen::base> focused_, last_, before_downloads_;
     };
 
 } // namespace bookwyrm::tui
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdlib>
+#include <experimental/filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+namespace fs = std::experimental::filesystem;
+
+/*
+ * What the unit tests share: each check() that fails is printed to stderr, and main() returns
+ * exit_status(), a failure if any check failed. Tests that write files do so in a temp_dir.
+ */
+
+inline int failures = 0;
+
+inline void check(bool ok, const std::string &what)
+{
+    if (!ok) {
+        std::cerr << "failed: " << what << '\n';
+        failures++;
+    }
+}
+
+inline int exit_status() { return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE; }
+
+/* A new directory in /tmp, removed with everything in it once out of scope. */
+class temp_dir {
+public:
+    explicit temp_dir(const std::string &name)
+    {
+        std::string tmpl = "/tmp/bookwyrm-test-" + name + ".XXXXXX";
+        if (!mkdtemp(tmpl.data()))
+            throw std::runtime_error("unable to create " + tmpl);
+        path_ = tmpl;
+    }
+
+    ~temp_dir()
+    {
+        std::error_code ec;
+        fs::remove_all(path_, ec);
+    }
+
+    temp_dir(const temp_dir &) = delete;
+    temp_dir &operator=(const temp_dir &) = delete;
+
+    const fs::path &path() const { return path_; }
+
+private:
+    fs::path path_;
+};
@@ -0,0 +1,98 @@
+/*
+ * Queues and finishes items in the on-disk download queue, reloads it as a later run would, and
+ * feeds it a queue torn by a crash.
+ */
+
+#include <fstream>
+#include <iterator>
+#include "components/download_queue.hpp"
+#include "core/hash.hpp"
+#include "check.hpp"
+
+using namespace bookwyrm;
+
+static core::item item(const std::string &title)
+{
+    return core::item(core::nonexacts_t({"Naomi Novik"}, title, "Temeraire", "Del Rey", "", ""),
+                      core::exacts_t(core::year_mod::equal, 2008, core::empty, core::empty, 350, 1048576, "epub"),
+                      core::misc_t({}, {"9780345496874"}, {"http://libgen.io/get.php?md5=" + title}, "libgen.py"));
+}
+
+static std::vector<std::string> titles(const download_queue &queue)
+{
+    std::vector<std::string> titles;
+    for (const auto &item : queue.items())
+        titles.push_back(item.nonexacts.title);
+    return titles;
+}
+
+static std::string contents(const fs::path &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+int main()
+{
+    const temp_dir tmp("download-queue");
+    const fs::path &dir = tmp.path();
+    const fs::path path = dir / ".bookwyrm-queue";
+
+    {
+        download_queue none{fs::path()};
+        none.add(item("Unrecorded"));
+        check(titles(none) == std::vector<std::string>{"Unrecorded"} && fs::is_empty(dir), "an unrecorded queue");
+    }
+
+    {
+        download_queue queue(path);
+        check(queue.items().empty() && !fs::exists(path), "no queue at first");
+
+        queue.add(item("His Majesty's Dragon"));
+        queue.add(item("Throne of Jade"));
+        queue.add(item("Black Powder War"));
+        queue.add(item("Throne of Jade"));
+        queue.remove(item("Throne of Jade"));
+        queue.remove(item("Not queued"));
+        check(titles(queue) == std::vector<std::string>{"His Majesty's Dragon", "Black Powder War"}, "queued items");
+    }
+
+    /* Without compacting, the file still holds the done entries; a later run replays them. */
+    const auto logged = contents(path);
+    {
+        download_queue queue(path);
+        check(titles(queue) == std::vector<std::string>{"His Majesty's Dragon", "Black Powder War"}, "round trip");
+    }
+    const auto compacted = contents(path);
+    check(compacted.size() < logged.size(), "done items are compacted away on load");
+    {
+        download_queue queue(path);
+        check(contents(path) == compacted, "compacting a compact queue changes nothing");
+    }
+
+    /* A crash while appending leaves the last entry torn. */
+    const auto torn = [&](const std::string &tail) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << compacted << tail;
+        download_queue queue(path);
+        return titles(queue) == std::vector<std::string>{"His Majesty's Dragon", "Black Powder War"} &&
+               contents(path) == compacted;
+    };
+    check(torn(compacted.substr(17, 40).insert(0, "Q")), "a torn queued entry is ignored");
+    check(torn("D\x01\x02\x03"), "a torn done entry is ignored");
+    check(torn("X"), "an unknown entry ends the log");
+
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << "bookwyrm-queue 0\n" << compacted.substr(17);
+        download_queue queue(path);
+        check(queue.items().empty() && !fs::exists(path), "queues of other versions are discarded");
+    }
+
+    {
+        download_queue queue(path);
+        queue.add(item("Empire of Ivory"));
+        queue.remove(item("Empire of Ivory"));
+        check(!fs::exists(path), "an emptied queue leaves no file behind");
+    }
+
+    return exit_status();
+}
@@ -0,0 +1,65 @@
+/*
+ * Extracts tables from HTML the way Library Genesis writes it, and from broken HTML.
+ */
+
+#include "core/html.hpp"
+#include "check.hpp"
+
+using namespace bookwyrm;
+namespace html = core::html;
+
+int main()
+{
+    const std::string page = R"(<!DOCTYPE html>
+<html><head><script>var s = "<table><tr><td>not a cell</td></tr></table>";</script></head>
+<body>
+<table width=100%><tr><td>layout</td></tr></table>
+<!-- <table class="c"><tr><td>commented out</td></tr></table> -->
+<table width=100% cellspacing=1 cellpadding=1 rules=rows class="c results">
+<tr valign=top bgcolor=#C0C0C0><td><b>ID</b></td><td><b>Title</b></td></tr>
+<tr><td>1</td>
+<td width=500><a href='search.php?req=Temeraire&column=series'><font face=Times color=green><i>Temeraire #5</i></font></a><br>
+<a href='book/index.php?md5=ABC' title='' id=12345>Victory of Eagles<br> <font face=Times color=green><i>[1st&nbsp;ed.]</i></font> <font><i>9780345496874, 0345496876</i></font></a>
+<td>Del Rey &amp; Co &#8212; &#x41;&unknown; & more</td>
+<td><table><tr><td>nested</td></tr></table>after</td>
+<tr><td>2<td><a href=/get.php?md5=DEF>Unquoted</a>
+</table>
+<table rules=rows><tr><th>Author</th></tr></table>
+</body></html>)";
+
+    const auto all = html::tables(page);
+    check(all.size() == 4, "all tables are found, nested ones included");
+
+    const auto results = html::tables(page, {{"class", "c"}, {"rules", "rows"}});
+    check(results.size() == 1, "tables are matched by class and attribute");
+    if (results.size() != 1)
+        return EXIT_FAILURE;
+
+    const auto &rows = results[0].rows;
+    check(rows.size() == 3, "unclosed rows are closed by the next");
+    check(rows[0].size() == 2 && rows[0][1].text == "Title", "header cells");
+    check(rows[1].size() == 4 && rows[2].size() == 2, "unclosed cells are closed by the next");
+
+    const auto &stei = rows[1][1];
+    check(stei.links.size() == 2, "links in a cell");
+    check(stei.links[0].fragments == vector<string>{"Temeraire #5"}, "link text");
+    check(stei.links[1].fragments ==
+              vector<string>{"Victory of Eagles", "[1st ed.]", "9780345496874, 0345496876"},
+          "link fragments, whitespace-only runs left out");
+    check(stei.links[1].attrs == html::attributes{{"href", "book/index.php?md5=ABC"}, {"title", ""}, {"id", "12345"}},
+          "link attributes");
+
+    check(rows[1][2].text == "Del Rey & Co — A&unknown; & more", "character references");
+    check(rows[1][3].text == "after", "nested tables' text is theirs only");
+    check(rows[2][1].links.size() == 1 && rows[2][1].links[0].attrs[0].second == "/get.php?md5=DEF", "unquoted attributes");
+
+    const auto th = html::tables(page, {{"rules", "rows"}});
+    check(th.size() == 2 && th[1].rows[0][0].text == "Author", "header cells in their own table");
+
+    check(html::tables("<table><td>a < b</td>").at(0).rows.at(0).at(0).text == "a < b", "a lone '<' is text");
+    check(html::tables("<table><tr><td><a href='unterminated").at(0).rows.at(0).at(0).links.size() == 1,
+          "truncated documents");
+    check(html::tables("").empty() && html::tables("</td></tr></table>").empty(), "stray end tags");
+
+    return exit_status();
+}
@@ -0,0 +1,110 @@
+/*
+ * Stores responses in and loads them from the HTTP cache, revalidates them, evicts them and feeds it broken entries.
+ */
+
+#include <fstream>
+#include <thread>
+#include <fmt/format.h>
+#include "core/http_cache.hpp"
+#include "check.hpp"
+
+using namespace bookwyrm;
+using core::http_cache;
+using core::http_response;
+
+static http_response response(const string &body, vector<std::pair<string, string>> headers = {})
+{
+    http_response r;
+    r.status = 200;
+    r.url = "http://libgen.io/search.php?req=Temeraire";
+    r.headers = std::move(headers);
+    r.body = body;
+    return r;
+}
+
+int main()
+{
+    const temp_dir tmp("http-cache");
+    const fs::path &dir = tmp.path();
+
+    {
+        http_cache cache(dir, 1 << 20);
+        const string page(100000, 'x');
+
+        cache.store("a", response(page, {{"content-type", "text/html"}}));
+        const auto a = cache.load("a");
+        check(a && a->fresh && a->response.cached, "a stored response is fresh");
+        check(a && a->response.body == page && a->response.headers.size() == 1 && a->response.status == 200,
+              "a stored response round-trips");
+        check(fs::file_size(dir / fmt::format("{:016x}.http", std::hash<string>()("a"))) < 1000, "bodies are compressed");
+        check(!cache.load("b"), "nothing is cached under another key");
+
+        cache.store("empty", response(""));
+        check(cache.load("empty") && cache.load("empty")->response.body.empty(), "empty bodies");
+
+        auto not_found = response("nope");
+        not_found.status = 404;
+        cache.store("404", not_found);
+        check(!cache.load("404"), "only successful responses are stored");
+
+        cache.store("no-store", response(page, {{"cache-control", "private, no-store"}}));
+        cache.store("vary", response(page, {{"vary", "*"}}));
+        check(!cache.load("no-store") && !cache.load("vary"), "Cache-Control: no-store and Vary: * are honoured");
+
+        cache.store("unvalidated", response(page, {{"cache-control", "max-age=0"}}));
+        check(!cache.load("unvalidated"), "stale responses without validators are not served");
+
+        cache.store("etag", response(page, {{"cache-control", "no-cache"}, {"etag", "\"v1\""}, {"last-modified", "then"}}));
+        const auto stale = cache.load("etag");
+        check(stale && !stale->fresh, "Cache-Control: no-cache is always revalidated");
+        check(http_cache::conditions(stale->response) ==
+                  vector<string>{"If-None-Match: \"v1\"", "If-Modified-Since: then"},
+              "conditional request headers");
+
+        auto not_modified = response("", {{"etag", "\"v2\""}, {"content-length", "0"}});
+        not_modified.status = 304;
+        const auto refreshed = cache.refresh("etag", stale->response, not_modified);
+        check(refreshed.body == page && refreshed.cached, "a 304 serves the cached body");
+        check(http_cache::conditions(cache.load("etag")->response).at(0) == "If-None-Match: \"v2\"",
+              "a 304 updates the cached headers");
+
+        {
+            /* As when search results are refreshed. */
+            cache.store("validated", response(page, {{"etag", "\"v1\""}}));
+            http_cache revalidating(dir, 1 << 20, true);
+            const auto validated = revalidating.load("validated");
+            check(validated && !validated->fresh && validated->response.body == page,
+                  "a revalidating cache serves nothing as fresh");
+            check(!revalidating.load("a"), "a revalidating cache drops responses without validators");
+        }
+
+        std::ofstream(dir / fmt::format("{:016x}.http", std::hash<string>()("a")), std::ios::binary | std::ios::trunc)
+            << "bwhc garbage";
+        check(!cache.load("a"), "corrupt entries are ignored");
+    }
+
+    {
+        /* Random, and so incompressible, bodies of 40 kB; three fit. */
+        http_cache cache(dir, 3 * 40000 + 3 * 200);
+        const auto random_page = [](unsigned seed) {
+            string s(40000, '\0');
+            for (auto &c : s)
+                c = static_cast<char>((seed = seed * 1103515245 + 12345) >> 16);
+            return s;
+        };
+
+        for (unsigned i = 1; i <= 3; i++) {
+            cache.store(std::to_string(i), response(random_page(i)));
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        check(cache.load("1") && cache.load("2") && cache.load("3"), "entries within the bound are kept");
+
+        /* "1" was used last of all, so "2" is evicted. */
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        cache.load("1");
+        cache.store("4", response(random_page(4)));
+        check(cache.load("1") && !cache.load("2") && cache.load("4"), "the least recently used entry is evicted");
+    }
+
+    return exit_status();
+}
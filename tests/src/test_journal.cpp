@@ -0,0 +1,68 @@
+/*
+ * Merges written ranges of a partial download, finds its gaps, and round-trips its journal.
+ */
+
+#include <fstream>
+#include "components/journal.hpp"
+#include "check.hpp"
+
+using namespace bookwyrm;
+using range = journal::range;
+
+int main()
+{
+    const temp_dir tmp("journal");
+    const fs::path &dir = tmp.path();
+    const fs::path path = dir / "item.epub.part.journal";
+
+    journal j;
+    j.item = 1234567890;
+    j.url = "http://libgen.io/get.php?md5=85a4ce67cdd4fba395ae5dfe1918d28d&key=a b";
+    j.md5 = "85a4ce67cdd4fba395ae5dfe1918d28d";
+    j.etag = "\"5d0-1a2b\"";
+    j.size = 1000;
+
+    j.add(500, 600);
+    j.add(100, 200);
+    j.add(0, 0);
+    j.add(300, 250);
+    check(j.ranges == vector<range>{{100, 200}, {500, 600}}, "ranges are kept in order, empty ones left out");
+
+    j.add(150, 300);
+    j.add(300, 400);
+    check(j.ranges == vector<range>{{100, 400}, {500, 600}}, "overlapping and adjacent ranges are merged");
+    check(j.gaps() == vector<range>{{0, 100}, {400, 500}, {600, 1000}}, "gaps");
+
+    journal whole = j;
+    whole.add(0, 1000);
+    check(whole.ranges == vector<range>{{0, 1000}} && whole.gaps().empty(), "a complete download has no gaps");
+
+    check(j.save(path) && !fs::exists(fs::path(path).concat(".tmp")), "saved");
+    const auto loaded = journal::load(path);
+    check(loaded && loaded->item == j.item && loaded->url == j.url && loaded->md5 == j.md5 && loaded->etag == j.etag &&
+              loaded->size == j.size && loaded->ranges == j.ranges,
+          "round trip");
+
+    journal sparse;
+    sparse.item = 1;
+    check(sparse.save(path), "saved without url, md5, etag or ranges");
+    const auto loaded_sparse = journal::load(path);
+    check(loaded_sparse && loaded_sparse->url.empty() && loaded_sparse->size == -1 && loaded_sparse->ranges.empty(),
+          "sparse round trip");
+
+    /* Broken journals. */
+    check(!journal::load(dir / "missing"), "missing file");
+    const auto write = [&path](const std::string &contents) {
+        std::ofstream(path, std::ios::trunc) << contents;
+        return journal::load(path);
+    };
+    check(!write(""), "empty file");
+    check(!write("bookwyrm-journal 0\nitem 1\n"), "other version");
+    check(!write("bookwyrm-journal 1\nitem 1\nsize x\n"), "malformed size");
+    check(!write("bookwyrm-journal 1\nitem 1\nsize 1000\nrange 10\n"), "truncated range");
+
+    check(!write("bookwyrm-journal 1\nitem 1\nsize 1000\nrange 0 10\nran"), "truncated file");
+    check(write("bookwyrm-journal 1\nitem 1\nsize 1000\nrange 0 10\nfuture field\n").has_value(), "unknown fields");
+
+    return exit_status();
+}
@@ -0,0 +1,51 @@
+/*
+ * Hashes the test suite of RFC 1321, whole and in pieces of every size.
+ */
+
+#include "components/md5.hpp"
+#include "check.hpp"
+
+using namespace bookwyrm;
+
+static std::string digest(const std::string &data, size_t piece)
+{
+    md5 hash;
+    for (size_t pos = 0; pos < data.size(); pos += piece)
+        hash.update(data.data() + pos, std::min(piece, data.size() - pos));
+    return hash.hexdigest();
+}
+
+int main()
+{
+    /* RFC 1321, appendix A.5. */
+    const std::pair<std::string, std::string> suite[] = {
+        {"", "d41d8cd98f00b204e9800998ecf8427e"},
+        {"a", "0cc175b9c0f1b6a831c399e269772661"},
+        {"abc", "900150983cd24fb0d6963f7d28e17f72"},
+        {"message digest", "f96b697d7cb7938d525a2f31aaf161d0"},
+        {"abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"},
+        {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", "d174ab98d277d9f5a5611c2c9f419d9f"},
+        {"12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+         "57edf4a22be3c955ac49da2e2107b67a"},
+    };
+
+    for (const auto & [ data, expected ] : suite) {
+        check(digest(data, std::max<size_t>(data.size(), 1)) == expected, "md5 of \"" + data + "\"");
+
+        /* Pieces that straddle the 64-byte blocks in every way. */
+        for (size_t piece = 1; piece < data.size(); piece++)
+            check(digest(data, piece) == expected, "md5 of \"" + data + "\" in pieces of " + std::to_string(piece));
+    }
+
+    /* A block's worth of padding: lengths around 55, 56 and 64 bytes. */
+    check(digest(std::string(55, 'a'), 55) == "ef1772b6dff9a122358552954ad0df65", "55 bytes");
+    check(digest(std::string(56, 'a'), 56) == "3b0c8ac703f828b04c6c197006d17218", "56 bytes");
+    check(digest(std::string(64, 'a'), 7) == "014842d480b571495a4a0363793f7367", "64 bytes in pieces");
+
+    md5 twice;
+    twice.update("abc", 3);
+    check(twice.hexdigest() == twice.hexdigest() && twice.hexdigest() == "900150983cd24fb0d6963f7d28e17f72",
+          "hexdigest() leaves the state as is");
+
+    return exit_status();
+}
@@ -0,0 +1,86 @@
+/*
+ * Round-trips items through the binary item format and feeds it broken records.
+ */
+
+#include "core/serialize.hpp"
+#include "check.hpp"
+
+using namespace bookwyrm;
+namespace serialize = core::serialize;
+using serialize::field;
+
+static bool same(const core::item &a, const core::item &b)
+{
+    return a.nonexacts.authors == b.nonexacts.authors && a.nonexacts.title == b.nonexacts.title &&
+           a.nonexacts.series == b.nonexacts.series && a.nonexacts.publisher == b.nonexacts.publisher &&
+           a.nonexacts.journal == b.nonexacts.journal && a.nonexacts.edition == b.nonexacts.edition &&
+           a.exacts.ymod == b.exacts.ymod && a.exacts.year == b.exacts.year && a.exacts.volume == b.exacts.volume &&
+           a.exacts.number == b.exacts.number && a.exacts.pages == b.exacts.pages && a.exacts.size == b.exacts.size &&
+           a.exacts.extension == b.exacts.extension && a.misc.uris == b.misc.uris && a.misc.isbns == b.misc.isbns &&
+           a.misc.mirrors == b.misc.mirrors && a.misc.origin_plugin == b.misc.origin_plugin;
+}
+
+static bool throws(std::string_view data)
+{
+    try {
+        serialize::decode(data);
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    const core::item empty{core::nonexacts_t(), core::exacts_t(), core::misc_t()};
+
+    std::vector<std::string> authors;
+    for (int i = 0; i < 200; i++)
+        authors.push_back("Author " + std::to_string(i));
+
+    const core::item full(core::nonexacts_t(authors, "Der Zauberberg — ßü ✓", "Series", "Publisher", "Journal", "2nd"),
+                          core::exacts_t(core::year_mod::eq_gt, 1924, 1, 2, 1000, 123456789, "epub"),
+                          core::misc_t({"http://a", "http://b"}, {"9780000000000"}, {"http://mirror"}, "plugin"));
+
+    /* Round trips, several records back to back. */
+    std::string buf;
+    serialize::encode(empty, buf);
+    const size_t first = buf.size();
+    serialize::encode(full, buf);
+
+    check(serialize::record_length(buf) == first, "record length");
+    check(same(serialize::decode(buf), empty), "empty item round trip");
+    check(same(serialize::decode(std::string_view(buf).substr(first), 42), full), "full item round trip");
+    check(serialize::decode(std::string_view(buf).substr(first), 42).index == 42, "index kept");
+
+    /* Reading fields in place. */
+    const serialize::item_view view(std::string_view(buf).substr(first));
+    check(view.version() == serialize::version, "version");
+    check(view.integer(field::year) == 1924, "integer field");
+    check(view.string(field::title) == full.nonexacts.title, "string field");
+    check(view.count(field::authors) == authors.size(), "list field count");
+    check(view.string(field::authors, 199) == "Author 199", "list field element");
+    check(view.string(field::authors, 200).empty() && view.string(static_cast<field>(200), 0).empty(),
+          "out-of-range list field elements");
+
+    /* Broken records. */
+    const std::string_view record = std::string_view(buf).substr(first);
+    check(throws({}), "empty data");
+    check(throws(record.substr(0, serialize::header_size - 1)), "truncated header");
+    check(throws(record.substr(0, record.size() - 1)), "truncated heap");
+
+    std::string bad(record);
+    bad[serialize::header_size + static_cast<size_t>(field::title) * serialize::slot_size + 3] = '\x7f';
+    check(throws(bad), "string out of bounds");
+
+    /* A record written before the later fields existed reads them as empty. */
+    std::string old(record);
+    const uint16_t fields = static_cast<uint16_t>(field::edition);
+    old.replace(6, sizeof(fields), reinterpret_cast<const char *>(&fields), sizeof(fields));
+    const auto item = serialize::decode(old);
+    check(item.nonexacts.title == full.nonexacts.title, "old record keeps known fields");
+    check(item.nonexacts.edition.empty() && item.misc.uris.empty() && item.misc.origin_plugin.empty(),
+          "old record reads missing fields as empty");
+
+    return exit_status();
+}